@@ -0,0 +1,518 @@
+//
+// This code is created by Hsin-Yuan Huang (https://momohuang.github.io/).
+// For more details, see the accompany paper:
+//  "Predicting Many Properties of a Quantum System from Very Few Measurements".
+//
+// This program generates synthetic workloads and measures the throughput of the library
+// behind prediction_shadow and data_acquisition_shadow.
+// The generated files are reproducible from the seed, and a timed run can be checked line by line
+// against the output of the command line programs (--reference), so a faster engine can be validated
+// against the current one.
+//
+#include <stdio.h>
+#include <cmath>
+#include <vector>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <string>
+#include <string.h>
+#include <climits>
+#include <algorithm>
+#include <random>
+#include "shadow_io.h"
+#include "shadow_observables.h"
+#include "shadow_measurements.h"
+#include "shadow_prediction.h"
+#include "shadow_derandomization.h"
+#include "shadow_randomization.h"
+
+using namespace std;
+
+//
+// The options of the generators and of the timed runs.
+// The options of the predictor (--threads, --engine, ...) are passed on to shadow_predictor::set_option.
+//
+shadow_predictor predictor;
+unsigned long long seed = 1;
+bool generate_weights = false;
+double duplication_rate = 0;
+bool nested_subsystems = false;
+int number_of_repeats = 1;
+const char* reference_file_name = NULL;
+const char* output_file_name = NULL;
+
+double current_time_in_seconds(){
+    struct timeval time;
+    gettimeofday(&time, NULL);
+    return time.tv_sec + time.tv_usec * 1e-6;
+}
+
+double peak_memory_in_megabytes(){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0; // ru_maxrss is in kilobytes on Linux
+}
+
+FILE* open_output_file(const char* file_name){
+    FILE* file = fopen(file_name, "w");
+    if(file == NULL)
+        throw_shadow_error("the output file \"%s\" cannot be created.", file_name);
+    return file;
+}
+
+//
+// The following function writes number_of_shots random single-shot measurements on system_size qubits.
+// A file name ending with .shadow is written in the binary format, anything else in the text format of [measurement.txt].
+//
+void generate_measurements(int system_size, int number_of_shots, const char* measurement_file_name){
+    mt19937_64 random_engine(seed);
+    int words_per_plane = (system_size + 63) / 64;
+    bool is_binary = strlen(measurement_file_name) > 7 && strcmp(measurement_file_name + strlen(measurement_file_name) - 7, ".shadow") == 0;
+
+    if(is_binary){
+        vector<unsigned long long> shots((size_t)number_of_shots * 3 * words_per_plane, 0);
+        for(int t = 0; t < number_of_shots; t++){
+            unsigned long long* shot = &shots[(size_t)t * 3 * words_per_plane];
+            for(int ith_qubit = 0; ith_qubit < system_size; ith_qubit++){
+                int pauli_encoding = (int)(random_engine() % 3);
+                int word = ith_qubit >> 6, bit = ith_qubit & 63;
+                shot[word] |= (unsigned long long)(pauli_encoding & 1) << bit;
+                shot[words_per_plane + word] |= (unsigned long long)(pauli_encoding >> 1) << bit;
+                shot[2 * words_per_plane + word] |= (unsigned long long)(random_engine() & 1) << bit;
+            }
+        }
+        write_shadow_file(measurement_file_name, system_size, 3, number_of_shots, shots.data());
+        return;
+    }
+
+    FILE* measurement_file = open_output_file(measurement_file_name);
+    fprintf(measurement_file, "%d\n", system_size);
+    string line;
+    for(int t = 0; t < number_of_shots; t++){
+        line.clear();
+        for(int ith_qubit = 0; ith_qubit < system_size; ith_qubit++){
+            int pauli_encoding = (int)(random_engine() % 3);
+            line += (char)('X' + pauli_encoding);
+            line += (random_engine() & 1)? " -1 ": " 1 ";
+        }
+        line += "\n";
+        fputs(line.c_str(), measurement_file);
+    }
+    fclose(measurement_file);
+}
+
+//
+// The following function writes number_of_observables random k-local observables on system_size qubits.
+// With --weights 1, every observable has a random weight from 0.5 to 2.
+// With --duplicates [rate], every observable is a copy of an earlier one with this probability
+// (with its Pauli operators in a different order), which exercises the deduplication.
+//
+void generate_observables(int system_size, int number_of_observables, int k_local, const char* observable_file_name){
+    if(k_local < 1 || k_local > system_size)
+        throw_shadow_error("the observables should act on 1 to [system size] qubits.");
+    mt19937_64 random_engine(seed);
+    auto random_unit = [&random_engine](){
+        return (random_engine() >> 11) * (1.0 / 9007199254740992.0);
+    };
+
+    FILE* observable_file = open_output_file(observable_file_name);
+    fprintf(observable_file, "%d\n", system_size);
+
+    vector<vector<pair<int, int> > > observables; // (pauli, qubit) for every Pauli operator
+    vector<double> weights;
+    vector<int> qubits(system_size);
+    for(int i = 0; i < number_of_observables; i++){
+        if(!observables.empty() && random_unit() < duplication_rate){
+            int copied = (int)(random_engine() % observables.size());
+            observables.push_back(observables[copied]);
+            weights.push_back(weights[copied]);
+            reverse(observables.back().begin(), observables.back().end());
+        }
+        else{
+            // A partial Fisher-Yates shuffle picks k distinct qubits
+            for(int q = 0; q < system_size; q++) qubits[q] = q;
+            vector<pair<int, int> > observable;
+            for(int k = 0; k < k_local; k++){
+                swap(qubits[k], qubits[k + random_engine() % (system_size - k)]);
+                observable.push_back(make_pair((int)(random_engine() % 3), qubits[k]));
+            }
+            observables.push_back(observable);
+            weights.push_back(generate_weights? 0.5 + 1.5 * random_unit(): 1.0);
+        }
+
+        fprintf(observable_file, "%d", k_local);
+        for(auto& pauli_and_qubit : observables.back())
+            fprintf(observable_file, " %c %d", 'X' + pauli_and_qubit.first, pauli_and_qubit.second);
+        if(generate_weights) fprintf(observable_file, " %.6f", weights.back());
+        fprintf(observable_file, "\n");
+    }
+    fclose(observable_file);
+}
+
+//
+// The following function writes number_of_subsystems subsystems of consecutive qubits with 1 to max_size qubits.
+// With --nested 1, the subsystems are the prefixes {q}, {q, q+1}, ..., of max_size qubits
+// starting at random qubits q, which are grouped into chains by the predictor.
+//
+void generate_subsystems(int system_size, int number_of_subsystems, int max_size, const char* subsystem_file_name){
+    if(max_size < 1 || max_size > system_size)
+        throw_shadow_error("the subsystems should have 1 to [system size] qubits.");
+    mt19937_64 random_engine(seed);
+
+    FILE* subsystem_file = open_output_file(subsystem_file_name);
+    fprintf(subsystem_file, "%d\n", system_size);
+    int first_qubit = 0;
+    for(int s = 0; s < number_of_subsystems; s++){
+        int subsystem_size;
+        if(nested_subsystems){
+            if(s % max_size == 0) first_qubit = (int)(random_engine() % (system_size - max_size + 1));
+            subsystem_size = s % max_size + 1;
+        }
+        else{
+            subsystem_size = 1 + (int)(random_engine() % max_size);
+            first_qubit = (int)(random_engine() % (system_size - subsystem_size + 1));
+        }
+        fprintf(subsystem_file, "%d", subsystem_size);
+        for(int q = first_qubit; q < first_qubit + subsystem_size; q++)
+            fprintf(subsystem_file, " %d", q);
+        fprintf(subsystem_file, "\n");
+    }
+    fclose(subsystem_file);
+}
+
+//
+// The following class collects the output of a timed run in the format of the command line programs,
+// and compares it with the file given by --reference.
+//
+class benchmark_output{
+public:
+    vector<string> lines;
+
+    void add_line(const char* format, ...) __attribute__((format(printf, 2, 3))){
+        char line[1 << 12];
+        va_list arguments;
+        va_start(arguments, format);
+        vsnprintf(line, sizeof(line), format, arguments);
+        va_end(arguments);
+        lines.push_back(line);
+    }
+
+    void add_observable_predictions(const pauli_observable_set& observable_set, const vector<int>& number_of_measurements, const vector<int>& sum_of_measurement_results,
+                                    const vector<vector<int> >& bucket_number_of_measurements, const vector<vector<int> >& bucket_sum_of_measurement_results){
+        for(int i = 0; i < observable_set.number_of_observables; i++){
+            int u = observable_set.unique_observable[i];
+            string line;
+            char value[64];
+            if(number_of_measurements[u] == 0) line = "0";
+            else{
+                snprintf(value, sizeof(value), "%f", 1.0 * sum_of_measurement_results[u] / number_of_measurements[u]);
+                line = value;
+            }
+            if(!bucket_number_of_measurements.empty()){
+                double standard_error, median_of_means;
+                shadow_predictor::observable_error_bars(u, number_of_measurements, sum_of_measurement_results,
+                                                        bucket_number_of_measurements, bucket_sum_of_measurement_results, standard_error, median_of_means);
+                snprintf(value, sizeof(value), " %f %f", standard_error, median_of_means);
+                line += value;
+            }
+            lines.push_back(line);
+        }
+    }
+
+    void add_entropy_predictions(const vector<double>& predicted_entropies){
+        for(double predicted_entropy : predicted_entropies) add_line("%f", predicted_entropy);
+    }
+
+    void write(const char* file_name){
+        FILE* file = open_output_file(file_name);
+        for(auto& line : lines) fprintf(file, "%s\n", line.c_str());
+        fclose(file);
+    }
+
+    //
+    // The following function returns true if every line is identical to the reference,
+    // ignoring the trailing spaces (which data_acquisition_shadow prints after every Pauli operator).
+    //
+    bool matches(const char* reference_file_name){
+        FILE* reference_file = fopen(reference_file_name, "r");
+        if(reference_file == NULL)
+            throw_shadow_error("the input file \"%s\" does not exist.", reference_file_name);
+        vector<string> reference_lines;
+        char* line = NULL;
+        size_t capacity = 0;
+        while(getline(&line, &capacity, reference_file) != -1) reference_lines.push_back(without_trailing_spaces(line));
+        free(line);
+        fclose(reference_file);
+
+        for(int l = 0; l < (int)max(lines.size(), reference_lines.size()); l++){
+            string benchmark_line = (l < (int)lines.size())? without_trailing_spaces(lines[l]): "(no line)";
+            string reference_line = (l < (int)reference_lines.size())? reference_lines[l]: "(no line)";
+            if(benchmark_line != reference_line){
+                printf("reference: differs on line %d\n  benchmark: %s\n  reference: %s\n", l + 1, benchmark_line.c_str(), reference_line.c_str());
+                return false;
+            }
+        }
+        printf("reference: identical (%d lines)\n", (int)lines.size());
+        return true;
+    }
+
+private:
+    static string without_trailing_spaces(string line){
+        while(!line.empty() && (line.back() == ' ' || line.back() == '\n' || line.back() == '\r')) line.pop_back();
+        return line;
+    }
+};
+
+//
+// The following function prints the timings of a run and the throughput in the given units,
+// e.g. ("shots", number of shots) is printed as shots/s over the compute time.
+//
+void print_report(const char* mode, double parse_time, double compute_time, const vector<pair<string, double> >& throughput){
+    printf("[Benchmark %s]\n", mode);
+    printf("parse time: %.3f s\n", parse_time);
+    printf("compute time: %.3f s (best of %d)\n", compute_time, number_of_repeats);
+    for(auto& unit : throughput)
+        printf("%s/s: %.0f\n", unit.first.c_str(), unit.second / max(compute_time, 1e-9));
+    printf("peak RSS: %.1f MB\n", peak_memory_in_megabytes());
+}
+
+//
+// The following function runs compute() [number_of_repeats] times and returns the shortest time.
+//
+template<class function_type>
+double best_time_of(function_type compute){
+    double best_time = -1;
+    for(int r = 0; r < number_of_repeats; r++){
+        double start_time = current_time_in_seconds();
+        compute();
+        double elapsed_time = current_time_in_seconds() - start_time;
+        if(best_time < 0 || elapsed_time < best_time) best_time = elapsed_time;
+    }
+    return best_time;
+}
+
+//
+// The following function times the prediction of local observables (-o), entanglement entropy (-e), or both (-oe).
+//
+void benchmark_prediction(const char* mode, const char* measurement_file_name, const char* observable_file_name, const char* subsystem_file_name, benchmark_output& output){
+    bool predict_observables = observable_file_name != NULL, predict_entropy = subsystem_file_name != NULL;
+
+    double start_time = current_time_in_seconds();
+    shadow_measurement_set measurements;
+    pauli_observable_set observable_set;
+    qubit_subsystem_set subsystems;
+    measurements.read(measurement_file_name);
+    if(predict_observables) observable_set.read(observable_file_name, measurements.system_size, false);
+    if(predict_entropy) subsystems.read(subsystem_file_name, measurements.system_size);
+    double parse_time = current_time_in_seconds() - start_time;
+
+    int number_of_unique_observables = predict_observables? observable_set.number_of_unique_observables: 0;
+    vector<int> number_of_measurements, sum_of_measurement_results;
+    vector<vector<int> > bucket_number_of_measurements, bucket_sum_of_measurement_results;
+    vector<double> predicted_entropies;
+    double compute_time = best_time_of([&](){
+        number_of_measurements.assign(number_of_unique_observables, 0);
+        sum_of_measurement_results.assign(number_of_unique_observables, 0);
+        bucket_number_of_measurements.assign(predictor.number_of_buckets, vector<int>(number_of_unique_observables, 0));
+        bucket_sum_of_measurement_results.assign(predictor.number_of_buckets, vector<int>(number_of_unique_observables, 0));
+
+        if(predict_observables && predict_entropy)
+            predictor.predict_observables_and_entropies(measurements, observable_set, subsystems, number_of_measurements, sum_of_measurement_results,
+                                                        bucket_number_of_measurements, bucket_sum_of_measurement_results, predicted_entropies);
+        else if(predict_observables){
+            if(predictor.number_of_buckets == 0)
+                predictor.accumulate_observables(measurements, observable_set, 0, measurements.number_of_shots, number_of_measurements, sum_of_measurement_results);
+            else
+                predictor.accumulate_observable_buckets(measurements, observable_set, 0, measurements.number_of_shots,
+                                                        bucket_number_of_measurements, bucket_sum_of_measurement_results);
+        }
+        else predictor.predict_entropies(measurements, subsystems, predicted_entropies);
+        shadow_predictor::add_observable_buckets(bucket_number_of_measurements, bucket_sum_of_measurement_results, number_of_measurements, sum_of_measurement_results);
+    });
+
+    if(predict_observables)
+        output.add_observable_predictions(observable_set, number_of_measurements, sum_of_measurement_results,
+                                          bucket_number_of_measurements, bucket_sum_of_measurement_results);
+    if(predict_entropy) output.add_entropy_predictions(predicted_entropies);
+
+    vector<pair<string, double> > throughput;
+    throughput.push_back(make_pair(string("shots"), (double)measurements.number_of_shots));
+    if(predict_observables) throughput.push_back(make_pair(string("observables"), (double)observable_set.number_of_observables));
+    if(predict_entropy) throughput.push_back(make_pair(string("subsystems"), (double)subsystems.size()));
+    print_report(mode, parse_time, compute_time, throughput);
+}
+
+//
+// The following function times the derandomized measurements (-d) for the observables in observable_file_name.
+//
+void benchmark_derandomization(int number_of_measurements_per_observable, const char* observable_file_name, benchmark_output& output){
+    double start_time = current_time_in_seconds();
+    pauli_observable_set observable_set;
+    observable_set.read(observable_file_name, -1, true);
+    double parse_time = current_time_in_seconds() - start_time;
+
+    int number_of_repetitions = 0;
+    double compute_time = best_time_of([&](){
+        output.lines.clear();
+        shadow_derandomizer derandomizer;
+        derandomizer.start(observable_set, number_of_measurements_per_observable, predictor.number_of_threads);
+
+        vector<int> paulis;
+        string line;
+        bool finished = false;
+        while(!finished){
+            finished = derandomizer.next_measurement(paulis);
+            line.clear();
+            for(int pauli : paulis){
+                line += (char)('X' + pauli);
+                line += ' ';
+            }
+            output.lines.push_back(line);
+        }
+        number_of_repetitions = derandomizer.number_of_repetitions;
+    });
+
+    vector<pair<string, double> > throughput;
+    throughput.push_back(make_pair(string("measurements"), (double)number_of_repetitions));
+    throughput.push_back(make_pair(string("observables"), (double)observable_set.number_of_observables));
+    print_report("-d", parse_time, compute_time, throughput);
+}
+
+//
+// The following function times the randomized measurements (-r) of data_acquisition_shadow with --seed,
+// written to /dev/null on [--threads] threads; the lines for --output and --reference are made afterwards.
+//
+void benchmark_randomization(long long number_of_total_measurements, int system_size, benchmark_output& output){
+    shadow_random_scheme random_scheme(seed);
+    double compute_time = best_time_of([&](){
+        FILE* null_file = open_output_file("/dev/null");
+        random_scheme.write_shots(number_of_total_measurements, system_size, predictor.number_of_threads, null_file, NULL);
+        fclose(null_file);
+    });
+
+    if(output_file_name != NULL || reference_file_name != NULL){
+        vector<char> line(2 * system_size + 1);
+        for(long long i = 0; i < number_of_total_measurements; i++){
+            random_scheme.write_text_shot(i, system_size, line.data());
+            output.lines.push_back(string(line.begin(), line.end() - 1));
+        }
+    }
+
+    vector<pair<string, double> > throughput;
+    throughput.push_back(make_pair(string("measurements"), (double)number_of_total_measurements));
+    print_report("-r", 0, compute_time, throughput);
+}
+
+//
+// The following function reads the optional arguments given after the other arguments (from argv[first_option] on).
+// Every option is a pair: --[name] [value]
+//
+void read_all_options(int argc, char* argv[], int first_option){
+    for(int a = first_option; a < argc; a += 2){
+        if(a + 1 >= argc)
+            throw_shadow_error("the option \"%s\" requires a value.", argv[a]);
+
+        if(predictor.set_option(argv[a], argv[a+1])) continue;
+        else if(strcmp(argv[a], "--seed") == 0) seed = strtoull(argv[a+1], NULL, 10);
+        else if(strcmp(argv[a], "--weights") == 0) generate_weights = atoi(argv[a+1]) != 0;
+        else if(strcmp(argv[a], "--duplicates") == 0){
+            duplication_rate = atof(argv[a+1]);
+            if(duplication_rate < 0 || duplication_rate > 1)
+                throw_shadow_error("the duplication rate should be from 0 to 1.");
+        }
+        else if(strcmp(argv[a], "--nested") == 0) nested_subsystems = atoi(argv[a+1]) != 0;
+        else if(strcmp(argv[a], "--repeat") == 0){
+            number_of_repeats = atoi(argv[a+1]);
+            if(number_of_repeats <= 0)
+                throw_shadow_error("the number of repeats should be positive.");
+        }
+        else if(strcmp(argv[a], "--reference") == 0) reference_file_name = argv[a+1];
+        else if(strcmp(argv[a], "--output") == 0) output_file_name = argv[a+1];
+        else throw_shadow_error("the option \"%s\" is not supported.", argv[a]);
+    }
+}
+
+//
+// The following function prints the usage of this program.
+//
+void print_usage(){
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "./benchmark_shadow -gm [system size] [number of shots] [measurement.txt] [options]\n");
+    fprintf(stderr, "    This option writes random measurements (in the .shadow format if the file name ends with .shadow).\n");
+    fprintf(stderr, "./benchmark_shadow -go [system size] [number of observables] [k-local] [observable.txt] [options]\n");
+    fprintf(stderr, "    This option writes random k-local observables.\n");
+    fprintf(stderr, "    --weights 1: give every observable a random weight from 0.5 to 2 (default: 0)\n");
+    fprintf(stderr, "    --duplicates [rate]: repeat an earlier observable with this probability (default: 0)\n");
+    fprintf(stderr, "./benchmark_shadow -gs [system size] [number of subsystems] [max size] [subsystem.txt] [options]\n");
+    fprintf(stderr, "    This option writes random subsystems of consecutive qubits.\n");
+    fprintf(stderr, "    --nested 1: write all the prefixes of random subsystems of [max size] qubits (default: 0)\n");
+    fprintf(stderr, "    All the generators accept --seed [number] (default: 1).\n");
+    fprintf(stderr, "<or>\n");
+    fprintf(stderr, "./benchmark_shadow -o [measurement.txt] [observable.txt] [options]\n");
+    fprintf(stderr, "./benchmark_shadow -e [measurement.txt] [subsystem.txt] [options]\n");
+    fprintf(stderr, "./benchmark_shadow -oe [measurement.txt] [observable.txt] [subsystem.txt] [options]\n");
+    fprintf(stderr, "./benchmark_shadow -d [number of measurements per observable] [observable.txt] [options]\n");
+    fprintf(stderr, "./benchmark_shadow -r [number of total measurements] [system size] [options]\n");
+    fprintf(stderr, "    These options time the modes of prediction_shadow and data_acquisition_shadow,\n");
+    fprintf(stderr, "    and print the parse time, the compute time, the throughput, and the peak memory.\n");
+    fprintf(stderr, "    They accept the options of prediction_shadow (e.g. --threads, --engine), and\n");
+    fprintf(stderr, "    --repeat [number]: run the computation this many times and report the fastest (default: 1)\n");
+    fprintf(stderr, "    --reference [file]: compare the predictions (or measurements) with the output of the command line program\n");
+    fprintf(stderr, "    --output [file]: write the predictions (or measurements) to this file\n");
+    fprintf(stderr, "    -r uses --seed, so its output can be compared with data_acquisition_shadow -r with the same --seed.\n");
+    return;
+}
+
+int run(int argc, char* argv[]){
+    if(argc < 2){
+        print_usage();
+        return -1;
+    }
+    // The number of arguments before the options in every mode
+    int first_option;
+    if(strcmp(argv[1], "-go") == 0 || strcmp(argv[1], "-gs") == 0) first_option = 6;
+    else if(strcmp(argv[1], "-gm") == 0 || strcmp(argv[1], "-oe") == 0) first_option = 5;
+    else first_option = 4;
+    if(argc < first_option){
+        print_usage();
+        return -1;
+    }
+    read_all_options(argc, argv, first_option);
+
+    benchmark_output output;
+    if(strcmp(argv[1], "-gm") == 0){
+        generate_measurements(atoi(argv[2]), atoi(argv[3]), argv[4]);
+        return 0;
+    }
+    else if(strcmp(argv[1], "-go") == 0){
+        generate_observables(atoi(argv[2]), atoi(argv[3]), atoi(argv[4]), argv[5]);
+        return 0;
+    }
+    else if(strcmp(argv[1], "-gs") == 0){
+        generate_subsystems(atoi(argv[2]), atoi(argv[3]), atoi(argv[4]), argv[5]);
+        return 0;
+    }
+    else if(strcmp(argv[1], "-o") == 0) benchmark_prediction("-o", argv[2], argv[3], NULL, output);
+    else if(strcmp(argv[1], "-e") == 0) benchmark_prediction("-e", argv[2], NULL, argv[3], output);
+    else if(strcmp(argv[1], "-oe") == 0) benchmark_prediction("-oe", argv[2], argv[3], argv[4], output);
+    else if(strcmp(argv[1], "-d") == 0) benchmark_derandomization(atoi(argv[2]), argv[3], output);
+    else if(strcmp(argv[1], "-r") == 0) benchmark_randomization(atoll(argv[2]), atoi(argv[3]), output);
+    else{
+        print_usage();
+        return -1;
+    }
+
+    if(output_file_name != NULL) output.write(output_file_name);
+    if(reference_file_name != NULL && !output.matches(reference_file_name)) return 1;
+    return 0;
+}
+
+int main(int argc, char* argv[]){
+    try{
+        return run(argc, argv);
+    }
+    catch(const shadow_error& error){
+        fprintf(stderr, "\n====\nError: %s\n====\n", error.what());
+        return -1;
+    }
+}
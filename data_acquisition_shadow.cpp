@@ -3,109 +3,25 @@
 // For more details, see the accompany paper:
 //  "Predicting Many Properties of a Quantum System from Very Few Measurements".
 //
+// This program prints the randomized Pauli measurements, or the derandomized ones
+// chosen by the shadow_derandomizer of shadow_derandomization.h.
+//
 #include <stdio.h>
 #include <cmath>
 #include <vector>
 #include <sys/time.h>
 #include <string>
 #include <string.h>
-#include <iostream>
-#include <fstream>
-#include <cassert>
-#include <sstream>
 #include <utility>
 #include <algorithm>
+#include <thread>
+#include "shadow_io.h"
+#include "shadow_observables.h"
+#include "shadow_derandomization.h"
+#include "shadow_randomization.h"
+#include "shadow_profile.h"
 
 using namespace std;
-const int INF = 999999999; // This is a very large number we call infinity
-
-double eta = 0.9; // This is a hyperparameter that should be tuned
-
-int system_size;
-int number_of_observables;
-int number_of_measurements_per_observable;
-int max_k_local;
-
-//
-// The following function reads the file: observable_file_name
-// and updates [observables] and [observables_acting_on_ith_qubit]
-//
-vector<vector<pair<int, int> > > observables; // observables to predict
-vector<vector<vector<int> > > observables_acting_on_ith_qubit;
-vector<double> observables_weight;
-
-void read_all_observables(char* observable_file_name){
-    ifstream observable_fstream;
-    observable_fstream.open(observable_file_name, ifstream::in);
-
-    if(observable_fstream.fail()){
-        fprintf(stderr, "\n====\nError: the input file \"%s\" does not exist.\n====\n", observable_file_name);
-        exit(-1);
-    }
-
-    // Read in the system size
-    observable_fstream >> system_size;
-
-    // Initialize the following numbers (will be changed later)
-    max_k_local = 0;
-    number_of_observables = 0;
-
-    //
-    // The grammar of observables_acting_on_ith_qubit:
-    //   observables_acting_on_ith_qubit[ith_qubit][0 or 1 or 2]
-    //     returns a list of indices for observables that applies X (0), Y (1), Z (2) on the ith_qubit
-    //
-    observables_acting_on_ith_qubit.clear();
-    vector<int> single_list;
-    vector<vector<int> > pauli_list;
-    pauli_list.push_back(single_list);
-    pauli_list.push_back(single_list);
-    pauli_list.push_back(single_list);
-    for(int i = 0; i < system_size; i++){
-        observables_acting_on_ith_qubit.push_back(pauli_list);
-    }
-
-    // Read in the local observables line by line
-    string line;
-    int observable_counter = 0;
-    while(getline(observable_fstream, line)){
-        if(line == "\n") continue;
-        istringstream single_line_stream(line);
-
-        int k_local;
-        single_line_stream >> k_local;
-        max_k_local = max(max_k_local, k_local);
-
-        vector<pair<int, int> > ith_observable;
-
-        for(int k = 0; k < k_local; k++){
-            char pauli_observable[5];
-            int position_of_pauli;
-            single_line_stream >> pauli_observable >> position_of_pauli;
-
-            assert(pauli_observable[0] == 'X' || pauli_observable[0] == 'Y' || pauli_observable[0] == 'Z');
-
-            int pauli_encoding = pauli_observable[0] - 'X'; // X -> 0, Y -> 1, Z -> 2
-
-            observables_acting_on_ith_qubit[position_of_pauli][pauli_encoding].push_back(observable_counter);
-            ith_observable.push_back(make_pair(position_of_pauli, pauli_encoding));
-        }
-
-        double weight;
-        int X = single_line_stream.rdbuf()->in_avail();
-        if(X == 0) weight = 1.0;
-        else single_line_stream >> weight;
-
-        observables_weight.push_back(weight);
-
-        observables.push_back(ith_observable);
-        observable_counter ++;
-    }
-    number_of_observables = observable_counter;
-    observable_fstream.close();
-
-    return;
-}
 
 //
 // The following function prints the usage of this program.
@@ -116,38 +32,155 @@ void print_usage(){
     fprintf(stderr, "    This is the derandomized version of classical shadow.\n");
     fprintf(stderr, "    We would output a list of Pauli measurements to measure all observables\n");
     fprintf(stderr, "    in [observable.txt] for at least [number of measurements per observable] times.\n");
+    fprintf(stderr, "    --threads [number]: score the candidate measurements on this many threads, 0 uses all cores (default: 1)\n");
+    fprintf(stderr, "                        the output does not depend on the number of threads.\n");
+    fprintf(stderr, "    --checkpoint [file]: keep the measurements chosen so far in this file, and resume from it if it exists\n");
+    fprintf(stderr, "    --checkpoint-interval [seconds]: how often the checkpoint is written (default: 60)\n");
+    fprintf(stderr, "    --scheme [file]: count the measurements in this file (the output of an earlier run) as already chosen,\n");
+    fprintf(stderr, "                     and only output the extra measurements\n");
+    fprintf(stderr, "    --profile [profile.json]: write the time of every phase, counters, and the peak memory as JSON (\"-\" for stderr)\n");
     fprintf(stderr, "<or>\n");
     fprintf(stderr, "./shadow_data_acquisition -r [number of total measurements] [system size]\n");
     fprintf(stderr, "    This is the randomized version of classical shadow.\n");
     fprintf(stderr, "    We would output a list of Pauli measurements for the given [system size]\n");
     fprintf(stderr, "    with a total of [number of total measurements] repetitions.\n");
+    fprintf(stderr, "    --seed [number]: the same seed gives the same measurements (default: from the clock, printed to stderr)\n");
+    fprintf(stderr, "    --threads [number]: generate the measurements on this many threads (default: 1)\n");
+    fprintf(stderr, "                        the output does not depend on the number of threads.\n");
+    fprintf(stderr, "    --output [file]: write the measurements to this file instead of stdout,\n");
+    fprintf(stderr, "                     as packed bases in the .shadow format if the file name ends with .shadow\n");
     return;
 }
 
 //
-// The following function performs multiplicative weight update,
-// which is used in derandomizing the random Pauli measurement for classical shadows.
+// The following function reads the optional arguments given after the first three arguments.
+// Every option is a pair: --[name] [value]
 //
-vector<double> log1ppow1o3k; // log1ppow1o3k[k] = log(1 + (e^(-eta / 2) - 1) / 3^k)
-double sum_log_value = 0.0;
-int sum_cnt = 0.0;
-double fail_prob_pessimistic(int cur_num_of_measurements, int how_many_pauli_to_match, double weight, double shift){ // stands for "failure probability by pessimistic estimator"
-    double log1pp0 = (how_many_pauli_to_match < INF? log1ppow1o3k[how_many_pauli_to_match] : 0.0);
+int number_of_threads = 1;
+const char* profile_file_name = NULL;
+const char* checkpoint_file_name = NULL;
+double checkpoint_interval = 60; // in seconds
+const char* scheme_file_name = NULL;
+bool has_seed = false;
+unsigned long long seed;
+const char* output_file_name = NULL;
+void read_all_options(int argc, char* argv[]){
+    for(int a = 4; a < argc; a += 2){
+        if(a + 1 >= argc)
+            throw_shadow_error("the option \"%s\" requires a value.", argv[a]);
+
+        if(strcmp(argv[a], "--threads") == 0){
+            number_of_threads = atoi(argv[a+1]);
+            if(number_of_threads == 0) number_of_threads = max(1, (int)thread::hardware_concurrency());
+            if(number_of_threads < 0)
+                throw_shadow_error("the number of threads should be positive.");
+        }
+        else if(strcmp(argv[a], "--checkpoint") == 0) checkpoint_file_name = argv[a+1];
+        else if(strcmp(argv[a], "--checkpoint-interval") == 0){
+            checkpoint_interval = atof(argv[a+1]);
+            if(checkpoint_interval < 0)
+                throw_shadow_error("the checkpoint interval should not be negative.");
+        }
+        else if(strcmp(argv[a], "--scheme") == 0) scheme_file_name = argv[a+1];
+        else if(strcmp(argv[a], "--seed") == 0){
+            has_seed = true;
+            seed = strtoull(argv[a+1], NULL, 10);
+        }
+        else if(strcmp(argv[a], "--output") == 0) output_file_name = argv[a+1];
+        else if(strcmp(argv[a], "--profile") == 0){
+            profile_file_name = argv[a+1];
+            shadow_profile::instance().enable();
+        }
+        else throw_shadow_error("the option \"%s\" is not supported.", argv[a]);
+    }
+}
 
-    if(floor(weight * number_of_measurements_per_observable) <= cur_num_of_measurements)
-        return 0;
+double current_time_in_seconds(){
+    struct timeval time;
+    gettimeofday(&time, NULL);
+    return time.tv_sec + time.tv_usec * 1e-6;
+}
 
-    double log_value = -eta / 2 * cur_num_of_measurements + log1pp0;
-    sum_log_value += (log_value / weight);
-    sum_cnt ++;
-    return 2 * exp((log_value / weight) - shift);
+//
+// The grammar of the checkpoint of -d:
+//   [system size] [number of measurements] [sum of the scaled log values] [number of scaled log values]
+//   [Pauli basis X/Y/Z for qubit 0] ... [Pauli basis X/Y/Z for qubit (system size - 1)]
+//   ... (one line for every measurement chosen so far)
+// The last two numbers are the statistics of the shift (see shadow_derandomizer::get_shift_statistics),
+// and the sum is written as a hexadecimal float so that it is restored exactly.
+// The counts of every observable are not stored, since crediting the measurements recomputes them.
+// The checkpoint is written to [checkpoint].tmp and then renamed, so a crash never leaves a partial checkpoint.
+//
+void write_checkpoint(const shadow_derandomizer& derandomizer, const vector<char>& chosen_paulis){
+    string temporary_file_name = string(checkpoint_file_name) + ".tmp";
+    FILE* checkpoint_file = fopen(temporary_file_name.c_str(), "w");
+    if(checkpoint_file == NULL)
+        throw_shadow_error("the checkpoint \"%s\" cannot be written.", temporary_file_name.c_str());
+
+    int system_size = derandomizer.system_size;
+    double sum_log_value;
+    int sum_cnt;
+    derandomizer.get_shift_statistics(sum_log_value, sum_cnt);
+    fprintf(checkpoint_file, "%d %lld %a %d\n", system_size, (long long)(chosen_paulis.size() / system_size), sum_log_value, sum_cnt);
+
+    string line;
+    for(size_t row = 0; row < chosen_paulis.size(); row += system_size){
+        line.clear();
+        for(int ith_qubit = 0; ith_qubit < system_size; ith_qubit++){
+            line += chosen_paulis[row + ith_qubit];
+            line += ' ';
+        }
+        line += '\n';
+        fputs(line.c_str(), checkpoint_file);
+    }
+
+    if(fclose(checkpoint_file) != 0 || rename(temporary_file_name.c_str(), checkpoint_file_name) != 0)
+        throw_shadow_error("the checkpoint \"%s\" cannot be written.", checkpoint_file_name);
 }
 
-int main(int argc, char* argv[]){
-    if(argc != 4){
+//
+// The following function resumes from the checkpoint if it exists:
+// its measurements are credited to the derandomizer and printed again,
+// so the output is the same as the output of a run that has never been interrupted.
+//
+void resume_from_checkpoint(shadow_derandomizer& derandomizer, vector<char>& chosen_paulis){
+    if(access(checkpoint_file_name, F_OK) != 0) return;
+
+    shadow_text_file checkpoint_file;
+    checkpoint_file.open(checkpoint_file_name);
+    if(!checkpoint_file.next_line()) checkpoint_file.report_malformed("the system size");
+    int system_size = checkpoint_file.read_int("the system size");
+    if(system_size != derandomizer.system_size)
+        throw_shadow_error("the system size do not match.");
+    int number_of_measurements = checkpoint_file.read_int("the number of measurements");
+    double sum_log_value = checkpoint_file.read_double("the sum of the scaled log values");
+    int sum_cnt = checkpoint_file.read_int("the number of scaled log values");
+
+    shadow_measurement_set checkpoint_measurements;
+    checkpoint_measurements.read_scheme(checkpoint_file, system_size);
+    if(checkpoint_measurements.number_of_shots != number_of_measurements)
+        throw_shadow_error("the checkpoint \"%s\" has %d measurements instead of %d.", checkpoint_file_name, checkpoint_measurements.number_of_shots, number_of_measurements);
+
+    derandomizer.credit_scheme(checkpoint_measurements);
+    derandomizer.set_shift_statistics(sum_log_value, sum_cnt);
+
+    for(int t = 0; t < checkpoint_measurements.number_of_shots; t++){
+        for(int ith_qubit = 0; ith_qubit < system_size; ith_qubit++){
+            char pauli = (char)('X' + checkpoint_measurements.pauli_basis(t, ith_qubit));
+            chosen_paulis.push_back(pauli);
+            printf("%c ", pauli);
+        }
+        printf("\n");
+    }
+    fprintf(stderr, "[Resumed %d measurements from \"%s\": %d]\n", number_of_measurements, checkpoint_file_name, derandomizer.number_satisfied);
+}
+
+int run(int argc, char* argv[]){
+    if(argc < 4){
         print_usage();
         return -1;
     }
+    read_all_options(argc, argv);
 
     //
     // Running the randomized version of classical shadows
@@ -156,138 +189,123 @@ int main(int argc, char* argv[]){
         //
         // Setup random seed for this run
         //
-        struct timeval time;
-        gettimeofday(&time,NULL);
-        srand((time.tv_sec * 1000) + (time.tv_usec / 1000));
+        if(!has_seed){
+            struct timeval time;
+            gettimeofday(&time,NULL);
+            seed = (time.tv_sec * 1000ULL) + (time.tv_usec / 1000);
+            fprintf(stderr, "[Seed %llu]\n", seed);
+        }
 
         //
         // Read in the parameter
         //
-        system_size = stoi(argv[3]);
-        int number_of_total_measurements = stoi(argv[2]);
-        char Pauli[] = {'X', 'Y', 'Z'};
+        int system_size = stoi(argv[3]);
+        long long number_of_total_measurements = stoll(argv[2]);
+        if(system_size <= 0 || number_of_total_measurements < 0)
+            throw_shadow_error("the system size should be positive and the number of measurements should not be negative.");
 
         //
         // Randomized version of classical shadows
         //
-        for(int i = 0; i < number_of_total_measurements; i++){
-            for(int j = 0; j < system_size; j++){
-                printf("%c ", Pauli[rand() % 3]);
-            }
-            printf("\n");
+        shadow_profile_phase phase("randomization");
+        shadow_random_scheme random_scheme(seed);
+        size_t name_length = (output_file_name == NULL)? 0: strlen(output_file_name);
+        if(name_length >= 7 && strcmp(output_file_name + name_length - 7, ".shadow") == 0)
+            random_scheme.write_shots(number_of_total_measurements, system_size, number_of_threads, NULL, output_file_name);
+        else{
+            FILE* output_file = (output_file_name == NULL)? stdout: fopen(output_file_name, "w");
+            if(output_file == NULL)
+                throw_shadow_error("the output file \"%s\" cannot be created.", output_file_name);
+            random_scheme.write_shots(number_of_total_measurements, system_size, number_of_threads, output_file, NULL);
+            if(output_file != stdout && fclose(output_file) != 0)
+                throw_shadow_error("failed to write the output file \"%s\".", output_file_name);
         }
     }
     //
     // Running the derandomized version of classical shadows
     //
     else if(strcmp(argv[1], "-d") == 0){
-        read_all_observables(argv[3]);
-
         //
-        // Precompute some constants for efficient usage in the derandomization process
+        // Identical observables (the same Pauli operators and the same weight) are merged into
+        // one unique observable with a multiplicity, which counts for every copy in the scores.
         //
-        double expm1eta = expm1(-eta / 2); // expm1eta = e^(-eta / 2) - 1
-        for(int k = 0; k < max_k_local+1; k++){
-            log1ppow1o3k.push_back(log1p(pow(1.0/3.0, k) * expm1eta));
+        pauli_observable_set observable_set;
+        {
+            shadow_profile_phase phase("parse observables");
+            observable_set.read(argv[3], -1, true);
         }
+        shadow_profile& profile = shadow_profile::instance();
+        profile.add_counter("observables", observable_set.number_of_observables);
+        profile.add_counter("unique observables", observable_set.number_of_unique_observables);
+        profile.add_counter("average inverted list length per qubit", 1.0 * observable_set.acting_observables.size() / max(1, observable_set.system_size));
+        int number_of_observables = observable_set.number_of_observables;
 
         //
-        // We want to measure each local observable this many times
+        // Derandomized version of classical shadows:
+        // we want to measure each local observable this many times
         //
-        number_of_measurements_per_observable = stoi(argv[2]);
+        shadow_derandomizer derandomizer;
+        derandomizer.start(move(observable_set), stoi(argv[2]), number_of_threads);
 
         //
-        // Derandomized version of classical shadows
+        // The measurements of an earlier scheme are not printed again,
+        // while the measurements of the checkpoint (which belong to this run) are.
         //
+        if(scheme_file_name != NULL){
+            shadow_measurement_set scheme;
+            scheme.read_scheme(scheme_file_name, derandomizer.system_size);
+            derandomizer.credit_scheme(scheme);
+            fprintf(stderr, "[Credited %d measurements from \"%s\": %d]\n", scheme.number_of_shots, scheme_file_name, derandomizer.number_satisfied);
+        }
+        vector<char> chosen_paulis; // the measurements of this run for the checkpoint, system_size letters each
+        if(checkpoint_file_name != NULL) resume_from_checkpoint(derandomizer, chosen_paulis);
+        double time_of_last_checkpoint = current_time_in_seconds();
 
-        // For every observable,
-        // how many times the observable has been measured
-        // in all previous measurement repetitions
-        vector<int> cur_num_of_measurements; // stands for "current number of measurements"
-        cur_num_of_measurements.resize(number_of_observables, 0); // initialize to zero
-
-        // For every observable,
-        // how many Pauli operators need to be matched to measure the observable
-        // in the current measurement repetition.
-        vector<int> how_many_pauli_to_match;
-        how_many_pauli_to_match.resize(number_of_observables);
-
-        for(int measurement_repetition = 0; measurement_repetition < INF; measurement_repetition++){
-            for(int i = 0; i < (int)observables.size(); i++)
-                how_many_pauli_to_match[i] = observables[i].size(); // initialize to k for k-local observable
-
-            double shift = (sum_cnt == 0)? 0: sum_log_value / sum_cnt;
-            sum_log_value = 0.0;
-            sum_cnt = 0;
-
-            for(int ith_qubit = 0; ith_qubit < system_size; ith_qubit++){
-                double prob_of_failure[3]; // for choosing X, Y, or Z
-                double smallest_prob_of_failure = -1;
-
-                //
-                // if we choose to measure pauli for ith_qubit in the current repetition
-                //
-                for(int pauli = 0; pauli < 3; pauli ++){
-                    prob_of_failure[pauli] = 0;
-
-                    // for every Pauli observable p, we can calculate a score
-                    for(int p = 0; p < 3; p ++){
-                        for(int i : observables_acting_on_ith_qubit[ith_qubit][p]){
-                            if(pauli == p){
-                                int pauli_to_match_next_step = how_many_pauli_to_match[i] == INF? INF: how_many_pauli_to_match[i]-1;
-                                double prob_next_step = fail_prob_pessimistic(cur_num_of_measurements[i], pauli_to_match_next_step, observables_weight[i], shift);
-                                double prob_current_step = fail_prob_pessimistic(cur_num_of_measurements[i], how_many_pauli_to_match[i], observables_weight[i], shift);
-                                prob_of_failure[pauli] += prob_next_step - prob_current_step;
-                            }
-                            else{
-                                double prob_next_step = fail_prob_pessimistic(cur_num_of_measurements[i], INF, observables_weight[i], shift);
-                                double prob_current_step = fail_prob_pessimistic(cur_num_of_measurements[i], how_many_pauli_to_match[i], observables_weight[i], shift);
-                                prob_of_failure[pauli] += prob_next_step - prob_current_step;
-                            }
-                        }
-                    }
-
-                    if(smallest_prob_of_failure == -1)
-                        smallest_prob_of_failure = prob_of_failure[pauli];
-                    else
-                        smallest_prob_of_failure = min(smallest_prob_of_failure, prob_of_failure[pauli]);
-                }
-
-                // Pick one with lowest failure probability
-                int the_best_pauli = 0;
-                for(int pauli = 0; pauli < 3; pauli ++){
-                    if(smallest_prob_of_failure == prob_of_failure[pauli]){
-                        printf("%c ", 'X' + pauli);
-                        the_best_pauli = pauli;
-                        break;
-                    }
-                }
-
-                for(int pauli = 0; pauli <= 2; pauli ++){
-                    for(int i : observables_acting_on_ith_qubit[ith_qubit][pauli]){
-                        if(the_best_pauli == pauli){
-                            if(how_many_pauli_to_match[i] != INF)
-                                how_many_pauli_to_match[i] -= 1;
-                        }
-                        else how_many_pauli_to_match[i] = INF;
-                    }
+        //
+        // The number of satisfied observables is sampled for the profile whenever
+        // another 1% of the observables is satisfied, so the series stays short for long runs.
+        //
+        vector<int> paulis;
+        int satisfied_at_last_sample = -1;
+        bool finished = derandomizer.number_of_repetitions > 0 && derandomizer.finished();
+        while(!finished){
+            finished = derandomizer.next_measurement(paulis);
+            {
+                shadow_profile_phase phase("output");
+                for(int ith_qubit = 0; ith_qubit < derandomizer.system_size; ith_qubit++)
+                    printf("%c ", 'X' + paulis[ith_qubit]);
+                printf("\n");
+
+                fprintf(stderr, "[Status %d: %d]\n", derandomizer.number_of_repetitions, derandomizer.number_satisfied);
+            }
+            if(checkpoint_file_name != NULL){
+                for(int pauli : paulis) chosen_paulis.push_back((char)('X' + pauli));
+                if(finished || current_time_in_seconds() >= time_of_last_checkpoint + checkpoint_interval){
+                    shadow_profile_phase phase("checkpoint");
+                    fflush(stdout);
+                    write_checkpoint(derandomizer, chosen_paulis);
+                    time_of_last_checkpoint = current_time_in_seconds();
                 }
             }
-            printf("\n");
-
-            for(int i = 0; i < (int)observables.size(); i++)
-                if(how_many_pauli_to_match[i] == 0) cur_num_of_measurements[i] ++;
+            if(finished || (long long)(derandomizer.number_satisfied - satisfied_at_last_sample) * 100 >= number_of_observables){
+                profile.add_sample("satisfied observables", derandomizer.number_of_repetitions, derandomizer.number_satisfied);
+                satisfied_at_last_sample = derandomizer.number_satisfied;
+            }
+        }
+        profile.add_counter("repetitions", derandomizer.number_of_repetitions);
+        profile.add_counter("exp calls", (double)derandomizer.number_of_exp_calls);
+    }
 
-            //
-            // Check the number of measurements for all the observables
-            //
-            int success = 0;
-            for(int i = 0; i < (int)observables.size(); i++)
-                if(cur_num_of_measurements[i] >= floor(observables_weight[i] * number_of_measurements_per_observable))
-                    success += 1;
-            fprintf(stderr, "[Status %d: %d]\n", measurement_repetition+1, success);
+    if(profile_file_name != NULL) shadow_profile::instance().write_json(profile_file_name, argc, argv);
+    return 0;
+}
 
-            if(success == (int)observables.size()) break;
-        }
+int main(int argc, char* argv[]){
+    try{
+        return run(argc, argv);
+    }
+    catch(const shadow_error& error){
+        fprintf(stderr, "\n====\nError: %s\n====\n", error.what());
+        return -1;
     }
 }
@@ -3,188 +3,621 @@
 // For more details, see the accompany paper:
 //  "Predicting Many Properties of a Quantum System from Very Few Measurements".
 //
+// This program reads the input files, runs the shadow_predictor of shadow_prediction.h,
+// and prints the predictions.
+//
 #include <stdio.h>
 #include <cmath>
 #include <vector>
 #include <sys/time.h>
 #include <string>
 #include <string.h>
-#include <iostream>
-#include <fstream>
-#include <sstream>
-#include <cassert>
-#include <utility>
+#include <climits>
 #include <algorithm>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "shadow_io.h"
+#include "shadow_observables.h"
+#include "shadow_measurements.h"
+#include "shadow_prediction.h"
+#include "shadow_profile.h"
+#include "shadow_chunked.h"
+#include "shadow_accumulators.h"
 
 using namespace std;
 
-int system_size = -1;
-int number_of_observables;
+shadow_predictor predictor;
 
-double renyi_sum_of_binary_outcome[100000000];
-double renyi_number_of_outcomes[100000000];
+// Only the shots from first_measurement_shot to last_measurement_shot-1 are read
+int first_measurement_shot = 0;
+int last_measurement_shot = INT_MAX;
 
-//
-// The following function reads the file: observable_file_name
-// and updates [observables] and [observables_acting_on_ith_qubit]
-//
-vector<vector<pair<int, int> > > observables; // observables to predict
-vector<vector<vector<int> > > observables_acting_on_ith_qubit;
-void read_all_observables(char* observable_file_name){
-    ifstream observable_fstream;
-    observable_fstream.open(observable_file_name, ifstream::in);
+// The profile of the run is written to this file ("-" for stderr) if it is not NULL
+const char* profile_file_name = NULL;
 
-    if(observable_fstream.fail()){
-        fprintf(stderr, "\n====\nError: the input file \"%s\" does not exist.\n====\n", observable_file_name);
-        exit(-1);
-    }
+// The accumulators of -o and -e are written to this file instead of the predictions if it is not NULL
+const char* accumulator_file_name = NULL;
 
-    // Read in the system size
-    int system_size_observable;
-    observable_fstream >> system_size_observable;
-    if(system_size == -1) system_size = system_size_observable;
+// Whether --engine is given (the Hamiltonian uses the grouped engine otherwise)
+bool engine_is_given = false;
 
-    // Initialize the following numbers (will be changed later)
-    number_of_observables = 0;
+//
+// The following function prints the predicted expectation value of every observable to output_file.
+// If the bucket accumulators are given, every line is followed by the standard error and the median of means.
+// The accumulators are int for a single run, and long long for the merged shards of -m.
+//
+template<class count_type>
+void print_observable_predictions(FILE* output_file, const vector<int>& unique_observable,
+                                  const vector<count_type>& number_of_measurements, const vector<count_type>& sum_of_measurement_results, bool report_unmeasured,
+                                  const vector<vector<count_type> >& bucket_number_of_measurements = vector<vector<count_type> >(),
+                                  const vector<vector<count_type> >& bucket_sum_of_measurement_results = vector<vector<count_type> >()){
+    for(int i = 0; i < (int)unique_observable.size(); i++){
+        int u = unique_observable[i];
+        if(number_of_measurements[u] == 0){
+            if(report_unmeasured) fprintf(stderr, "%d-th Observable is not measured at all\n", i+1);
+            fprintf(output_file, "0");
+        }
+        else fprintf(output_file, "%f", 1.0 * sum_of_measurement_results[u] / number_of_measurements[u]);
 
-    //
-    // The grammar of observables_acting_on_ith_qubit:
-    //   observables_acting_on_ith_qubit[ith_qubit][0 or 1 or 2]
-    //     returns a list of indices for observables that applies X (0), Y (1), Z (2) on the ith_qubit
-    //
-    observables_acting_on_ith_qubit.clear();
-    vector<int> single_list;
-    vector<vector<int> > pauli_list;
-    pauli_list.push_back(single_list);
-    pauli_list.push_back(single_list);
-    pauli_list.push_back(single_list);
-    for(int i = 0; i < system_size; i++){
-        observables_acting_on_ith_qubit.push_back(pauli_list);
+        if(!bucket_number_of_measurements.empty()){
+            double standard_error, median_of_means;
+            shadow_predictor::observable_error_bars(u, number_of_measurements, sum_of_measurement_results,
+                                                    bucket_number_of_measurements, bucket_sum_of_measurement_results, standard_error, median_of_means);
+            fprintf(output_file, " %f %f", standard_error, median_of_means);
+        }
+        fprintf(output_file, "\n");
     }
+}
 
-    // Read in the local observables line by line
-    string line;
-    int observable_counter = 0;
-    while(getline(observable_fstream, line)){
-        if(line == "\n" || line == "") continue;
-        istringstream single_line_stream(line);
+//
+// The following function adds the counters of the local observables to the profile:
+// how many unique observables a shot measures on average, and the average length of the inverted lists of a qubit.
+//
+void profile_observable_counters(const pauli_observable_set& observable_set, long long number_of_shots, const vector<int>& number_of_measurements){
+    shadow_profile& profile = shadow_profile::instance();
+    if(!profile.enabled()) return;
+
+    long long number_of_hits = 0;
+    for(int count : number_of_measurements) number_of_hits += count;
+    profile.add_counter("observables", observable_set.number_of_observables);
+    profile.add_counter("unique observables", observable_set.number_of_unique_observables);
+    profile.add_counter("observable hits per shot", (number_of_shots > 0)? 1.0 * number_of_hits / number_of_shots: 0);
+    profile.add_counter("average inverted list length per qubit", 1.0 * observable_set.acting_observables.size() / max(1, observable_set.system_size));
+}
 
-        int k_local;
-        single_line_stream >> k_local;
+//
+// The following functions read the input files, timed as phases of the profile.
+//
+void read_measurements(const char* measurement_file_name, shadow_measurement_set& measurements){
+    shadow_profile_phase phase("parse measurements");
+    measurements.read(measurement_file_name, -1, first_measurement_shot, last_measurement_shot);
+    shadow_profile::instance().add_counter("shots", measurements.number_of_shots);
+}
 
-        vector<pair<int, int> > ith_observable;
+void read_observables(shadow_text_file& observable_file, int system_size, pauli_observable_set& observable_set, bool read_weights = false){
+    {
+        shadow_profile_phase phase("parse observables");
+        observable_set.read(observable_file, system_size, read_weights);
+    }
+    if(predictor.observable_engine == "grouped"){
+        observable_set.build_support_groups();
+        shadow_profile::instance().add_counter("support groups", observable_set.number_of_support_groups());
+    }
+}
 
-        for(int k = 0; k < k_local; k++){
-            char pauli_observable[5];
-            int position_of_pauli;
-            single_line_stream >> pauli_observable >> position_of_pauli;
+void read_observables(const char* observable_file_name, int system_size, pauli_observable_set& observable_set, bool read_weights = false){
+    shadow_text_file observable_file;
+    observable_file.open(observable_file_name);
+    read_observables(observable_file, system_size, observable_set, read_weights);
+}
 
-            assert(pauli_observable[0] == 'X' || pauli_observable[0] == 'Y' || pauli_observable[0] == 'Z');
+void read_subsystems(shadow_text_file& subsystem_file, int system_size, qubit_subsystem_set& subsystems){
+    shadow_profile_phase phase("parse subsystems");
+    subsystems.read(subsystem_file, system_size);
+    shadow_profile::instance().add_counter("subsystems", subsystems.size());
+}
 
-            int pauli_encoding = pauli_observable[0] - 'X'; // X -> 0, Y -> 1, Z -> 2
+void read_subsystems(const char* subsystem_file_name, int system_size, qubit_subsystem_set& subsystems){
+    shadow_text_file subsystem_file;
+    subsystem_file.open(subsystem_file_name);
+    read_subsystems(subsystem_file, system_size, subsystems);
+}
 
-            observables_acting_on_ith_qubit[position_of_pauli][pauli_encoding].push_back(observable_counter);
-            ith_observable.push_back(make_pair(position_of_pauli, pauli_encoding));
+//
+// The following functions keep the entropy accumulators of all subsystems in memory while the shots go by,
+// for the streaming and the chunked predictions, where the shots are only seen once.
+// The subsystems are evaluated as the chains of build_renyi_chains with the Gray-code engine.
+// Since the number of shots is not known in advance, "auto" keeps the entropy accumulators of
+// subsystems with more than [STREAM_DENSE_MAX_QUBITS] qubits in a sparse workspace that grows with the shots,
+// and the dense accumulators must fit in the memory budget.
+// The Gray-code engine enumerates 2^k operators per shot, so the subsystems have at most [GRAYCODE_MAX_QUBITS] qubits.
+//
+const int STREAM_DENSE_MAX_QUBITS = 12;
+
+void start_renyi_accumulators(const qubit_subsystem_set& subsystems, vector<renyi_chain>& chains, vector<vector<renyi_counts_workspace> >& workspaces){
+    if(predictor.renyi_engine == "pairwise")
+        throw_shadow_error("the pairwise entropy engine needs all the shots in memory.");
+    vector<int> all_subsystems;
+    for(int s = 0; s < subsystems.size(); s++) all_subsystems.push_back(s);
+    chains = build_renyi_chains(subsystems, all_subsystems);
+
+    long long memory_needed = 0;
+    workspaces.clear();
+    for(auto& chain : chains){
+        workspaces.push_back(vector<renyi_counts_workspace>(chain.prefix_sizes.size()));
+        for(int m = 0; m < (int)chain.prefix_sizes.size(); m++){
+            int subsystem_size = chain.prefix_sizes[m];
+            if(subsystem_size > GRAYCODE_MAX_QUBITS)
+                throw_shadow_error("the gray code engine supports subsystems of at most %d qubits, and larger subsystems need all the shots in memory.", GRAYCODE_MAX_QUBITS);
+            bool is_sparse = (predictor.renyi_counts_mode == "auto")? subsystem_size > STREAM_DENSE_MAX_QUBITS: predictor.renyi_counts_mode == "sparse";
+            if(!is_sparse) memory_needed += renyi_dense_bytes(subsystem_size);
+            workspaces.back()[m].is_sparse = is_sparse;
         }
-
-        observables.push_back(ith_observable);
-        observable_counter ++;
     }
-    number_of_observables = observable_counter;
-    observable_fstream.close();
-
-    return;
+    if(memory_needed > predictor.renyi_memory_budget)
+        throw_shadow_error("keeping the entropy of these subsystems needs %lld MB, more than the memory budget.", memory_needed >> 20);
+    for(int c = 0; c < (int)chains.size(); c++)
+        for(int m = 0; m < (int)chains[c].prefix_sizes.size(); m++)
+            workspaces[c][m].reset(chains[c].prefix_sizes[m], workspaces[c][m].is_sparse, 0);
 }
 
 //
-// The following function reads the file: subsystem_file_name
-// and updates [subsystems].
+// The chains are split across [number_of_threads] threads, and every chain is only updated by one of them.
 //
-vector<vector<int> > subsystems; // subsystems to predict entropy
-void read_all_subsystems(char* subsystem_file_name){
-    ifstream subsystem_fstream;
-    subsystem_fstream.open(subsystem_file_name, ifstream::in);
+void add_renyi_accumulators(const shadow_measurement_set& measurements, const vector<renyi_chain>& chains, vector<vector<renyi_counts_workspace> >& workspaces){
+    shadow_profile_phase phase("accumulate entropy counts");
+    int threads_to_use = max(1, min(predictor.number_of_threads, (int)chains.size()));
+    auto add_chains = [&](int th){
+        for(int c = th; c < (int)chains.size(); c += threads_to_use)
+            accumulate_renyi_counts(measurements, chains[c], 0, measurements.number_of_shots, workspaces[c]);
+    };
+    vector<thread> workers;
+    for(int th = 1; th < threads_to_use; th++) workers.push_back(thread(add_chains, th));
+    add_chains(0);
+    for(auto& worker : workers) worker.join();
+}
 
-    if(subsystem_fstream.fail()){
-        fprintf(stderr, "\n====\nError: the input file \"%s\" does not exist.\n====\n", subsystem_file_name);
-        exit(-1);
+void predict_renyi_accumulators(const qubit_subsystem_set& subsystems, const vector<renyi_chain>& chains, const vector<vector<renyi_counts_workspace> >& workspaces,
+                                vector<double>& predicted_entropies){
+    shadow_profile_phase phase("entropy normalization");
+    predicted_entropies.assign(subsystems.size(), 0);
+    for(int c = 0; c < (int)chains.size(); c++){
+        for(int m = 0; m < (int)chains[c].prefix_sizes.size(); m++){
+            double predicted_entropy = renyi_entropy_from_counts(chains[c].prefix_sizes[m], workspaces[c][m]);
+            for(int s : chains[c].subsystem_indices[m]) predicted_entropies[s] = predicted_entropy;
+        }
     }
+}
 
-    // Read in the system size
-    int system_size_subsystem;
-    subsystem_fstream >> system_size_subsystem;
-    if(system_size == -1) system_size = system_size_subsystem;
+//
+// The following function predicts the local observables (or the entanglement entropy)
+// while the measurements are being written to the stream: stream_name.
+// The shots are packed in batches of [STREAM_BATCH_SHOTS] into [measurements],
+// added to the accumulators, and then dropped, so the memory does not grow with the stream.
+// The predictions are printed every [report_every_shots] shots and every [report_interval] seconds,
+// and once more at the end of the stream.
+//
+const int STREAM_BATCH_SHOTS = 16 * BITPLANE_TILE_SHOTS;
+long long report_every_shots = 10000;
+double report_interval = 0; // in seconds, 0 means no time-based reports
+
+double current_time_in_seconds(){
+    struct timeval time;
+    gettimeofday(&time, NULL);
+    return time.tv_sec + time.tv_usec * 1e-6;
+}
 
-    // Read in the local observables line by line
-    string line;
-    int observable_counter = 0;
-    while(getline(subsystem_fstream, line)){
-        if(line == "\n" || line == "") continue;
-        istringstream single_line_stream(line);
+void run_streaming_prediction(char* stream_name, const pauli_observable_set& observable_set, const qubit_subsystem_set& subsystems, bool predict_entropy){
+    int system_size = predict_entropy? subsystems.system_size: observable_set.system_size;
+
+    // The accumulators for the local observables
+    vector<int> number_of_measurements(observable_set.number_of_unique_observables, 0);
+    vector<int> sum_of_measurement_results(observable_set.number_of_unique_observables, 0);
+
+    // The accumulators for the entanglement entropy
+    vector<renyi_chain> chains;
+    vector<vector<renyi_counts_workspace> > workspaces;
+    if(predict_entropy) start_renyi_accumulators(subsystems, chains, workspaces);
+
+    shadow_text_stream measurement_stream;
+    measurement_stream.open(stream_name);
+    shadow_text_file lines;
+
+    shadow_measurement_set measurements;
+    bool has_system_size = false;
+    long long shots_received = 0, shots_at_last_report = -1;
+    double time_of_last_report = current_time_in_seconds();
+
+    // Add the shots in the current batch to the accumulators
+    auto add_batch = [&](){
+        if(measurements.number_of_shots == 0) return;
+        if(predict_entropy) add_renyi_accumulators(measurements, chains, workspaces);
+        else predictor.accumulate_observables(measurements, observable_set, 0, measurements.number_of_shots, number_of_measurements, sum_of_measurement_results);
+        measurements.clear_shots();
+    };
+    auto report = [&](bool end_of_stream){
+        time_of_last_report = current_time_in_seconds();
+        if(shots_received == shots_at_last_report) return;
+        add_batch();
+        printf("[Prediction after %lld shots]\n", shots_received);
+        if(predict_entropy){
+            vector<double> predicted_entropies;
+            predict_renyi_accumulators(subsystems, chains, workspaces, predicted_entropies);
+            shadow_profile_phase phase("output");
+            for(int s = 0; s < subsystems.size(); s++)
+                printf("%f\n", predicted_entropies[s]);
+        }
+        else{
+            shadow_profile_phase phase("output");
+            print_observable_predictions(stdout, observable_set.unique_observable, number_of_measurements, sum_of_measurement_results, end_of_stream);
+        }
+        fflush(stdout);
+        shots_at_last_report = shots_received;
+    };
+
+    while(true){
+        double timeout = (report_interval > 0)? max(0.0, time_of_last_report + report_interval - current_time_in_seconds()): -1;
+        bool stream_is_open = measurement_stream.receive(timeout, lines);
+
+        while(lines.next_line()){
+            // The first line is the system size
+            if(!has_system_size){
+                int system_size_measurement = lines.read_int("the system size");
+                if(system_size_measurement != system_size)
+                    throw_shadow_error("the system size do not match.");
+                measurements.start_batches(system_size, STREAM_BATCH_SHOTS);
+                has_system_size = true;
+                continue;
+            }
 
-        int k_local;
-        single_line_stream >> k_local;
+            measurements.append_line(lines);
+            shots_received ++;
 
-        vector<int> ith_subsystem;
+            if(measurements.number_of_shots == STREAM_BATCH_SHOTS) add_batch();
+            if(report_every_shots > 0 && shots_received % report_every_shots == 0) report(false);
+        }
 
-        for(int k = 0; k < k_local; k++){
-            int position_of_the_qubit;
-            single_line_stream >> position_of_the_qubit;
-            ith_subsystem.push_back(position_of_the_qubit);
+        if(!stream_is_open){
+            report(true);
+            shadow_profile::instance().add_counter("shots", (double)shots_received);
+            if(!predict_entropy) profile_observable_counters(observable_set, shots_received, number_of_measurements);
+            break;
         }
+        if(report_interval > 0 && current_time_in_seconds() >= time_of_last_report + report_interval) report(false);
+    }
+}
 
-        subsystems.push_back(ith_subsystem);
+//
+// The following functions print the predictions of -o and -e,
+// or write their accumulators to the file of --accumulators (to be merged with -m).
+//
+void output_observables(const pauli_observable_set& observable_set, long long number_of_shots,
+                        const vector<int>& number_of_measurements, const vector<int>& sum_of_measurement_results,
+                        const vector<vector<int> >& bucket_number_of_measurements, const vector<vector<int> >& bucket_sum_of_measurement_results){
+    shadow_profile_phase phase("output");
+    if(accumulator_file_name == NULL){
+        print_observable_predictions(stdout, observable_set.unique_observable, number_of_measurements, sum_of_measurement_results, true,
+                                     bucket_number_of_measurements, bucket_sum_of_measurement_results);
+        return;
     }
-    subsystem_fstream.close();
+    shadow_accumulators accumulators;
+    accumulators.assign_observables(observable_set, number_of_shots, number_of_measurements, sum_of_measurement_results,
+                                    bucket_number_of_measurements, bucket_sum_of_measurement_results);
+    accumulators.write(accumulator_file_name);
+    fprintf(stderr, "Wrote the accumulators of %lld measurements to \"%s\"\n", number_of_shots, accumulator_file_name);
+}
 
-    return;
+void output_entropies(const qubit_subsystem_set& subsystems, long long number_of_shots,
+                      const vector<renyi_chain>& chains, const vector<vector<renyi_counts_workspace> >& workspaces){
+    if(accumulator_file_name == NULL){
+        vector<double> predicted_entropies;
+        predict_renyi_accumulators(subsystems, chains, workspaces, predicted_entropies);
+        shadow_profile_phase phase("output");
+        for(int s = 0; s < subsystems.size(); s++)
+            printf("%f\n", predicted_entropies[s]);
+        return;
+    }
+    shadow_profile_phase phase("output");
+    shadow_accumulators accumulators;
+    accumulators.assign_entropy(subsystems, number_of_shots, chains, workspaces);
+    accumulators.write(accumulator_file_name);
+    fprintf(stderr, "Wrote the accumulators of %lld measurements to \"%s\"\n", number_of_shots, accumulator_file_name);
 }
 
 //
-// The following function reads the file: measurement_file_name
-// and updates [observables] and [observables_acting_on_ith_qubit]
+// The following function merges the accumulator files argv[first_file] to argv[last_file-1] (-m),
+// and prints the predictions of -o or -e for all their shots together.
+// The buckets of --buckets are the buckets of all the files.
 //
-vector<vector<int> > measurement_pauli_basis;
-vector<vector<int> > measurement_binary_outcome;
-void read_all_measurements(char* measurement_file_name){
-    ifstream measurement_fstream;
-    measurement_fstream.open(measurement_file_name, ifstream::in);
+void merge_accumulators(char* argv[], int first_file, int last_file){
+    shadow_accumulators accumulators;
+    {
+        shadow_profile_phase phase("merge accumulators");
+        accumulators.read(argv[first_file]);
+        for(int f = first_file + 1; f < last_file; f++){
+            shadow_accumulators shard;
+            shard.read(argv[f]);
+            accumulators.merge(shard);
+        }
+    }
+    shadow_profile::instance().add_counter("shots", (double)accumulators.number_of_shots);
+    fprintf(stderr, "Merged %d accumulator files of %lld measurements\n", last_file - first_file, accumulators.number_of_shots);
+
+    shadow_profile_phase phase("output");
+    if(accumulators.kind == SHADOW_ACCUMULATOR_ENTROPY){
+        for(int t : accumulators.table_of_subsystem)
+            printf("%f\n", renyi_entropy_from_counts(accumulators.tables[t].subsystem_size, accumulators.tables[t]));
+        return;
+    }
+
+    print_observable_predictions(stdout, accumulators.unique_observable, accumulators.number_of_measurements, accumulators.sum_of_measurement_results, true,
+                                 accumulators.bucket_number_of_measurements, accumulators.bucket_sum_of_measurement_results);
+}
 
-    if(measurement_fstream.fail()){
-        fprintf(stderr, "\n====\nError: the input file \"%s\" does not exist.\n====\n", measurement_file_name);
-        exit(-1);
+//
+// The following function predicts the local observables (or the entanglement entropy) from the file: measurement_file_name
+// without reading it into memory (--chunk-memory): the shots are read in chunks by shadow_chunked_reader
+// while the previous chunk is added to the accumulators.
+// The accumulators of the local observables are the integer accumulators of the in-memory prediction,
+// so the predictions are identical; the buckets of --buckets need the number of shots in advance (a .shadow file).
+// The entropy uses the accumulators of the streaming prediction, identical to --entropy-engine graycode in memory.
+//
+long long chunk_memory = 0; // in bytes, 0 means the measurements are read into memory
+
+void run_chunked_prediction(const char* measurement_file_name, const char* input_file_name, bool predict_entropy){
+    shadow_chunked_reader reader;
+    reader.open(measurement_file_name, -1, first_measurement_shot, last_measurement_shot, chunk_memory);
+    long long shots_read = 0;
+
+    if(predict_entropy){
+        qubit_subsystem_set subsystems;
+        read_subsystems(input_file_name, reader.system_size, subsystems);
+        vector<renyi_chain> chains;
+        vector<vector<renyi_counts_workspace> > workspaces;
+        start_renyi_accumulators(subsystems, chains, workspaces);
+
+        reader.for_each_chunk([&](const shadow_measurement_set& chunk, long long){
+            add_renyi_accumulators(chunk, chains, workspaces);
+            shots_read += chunk.number_of_shots;
+        });
+        shadow_profile::instance().add_counter("shots", (double)shots_read);
+        output_entropies(subsystems, shots_read, chains, workspaces);
+        return;
     }
 
-    // Read in the system size
-    int system_size_measurement;
-    measurement_fstream >> system_size_measurement;
-    if(system_size == -1) system_size = system_size_measurement;
-    if(system_size_measurement != system_size){
-        fprintf(stderr, "\n====\nError: the system size do not match.\n====\n");
-        exit(-1);
+    pauli_observable_set observable_set;
+    read_observables(input_file_name, reader.system_size, observable_set);
+    if(predictor.number_of_buckets > 0 && reader.number_of_shots < 0)
+        throw_shadow_error("--buckets with --chunk-memory needs a .shadow file, whose number of shots is known in advance.");
+
+    int number_of_unique_observables = observable_set.number_of_unique_observables;
+    vector<int> number_of_measurements(number_of_unique_observables, 0), sum_of_measurement_results(number_of_unique_observables, 0);
+    vector<vector<int> > bucket_number_of_measurements(predictor.number_of_buckets, vector<int>(number_of_unique_observables, 0));
+    vector<vector<int> > bucket_sum_of_measurement_results(predictor.number_of_buckets, vector<int>(number_of_unique_observables, 0));
+    reader.for_each_chunk([&](const shadow_measurement_set& chunk, long long shot_offset){
+        if(predictor.number_of_buckets == 0)
+            predictor.accumulate_observables(chunk, observable_set, 0, chunk.number_of_shots, number_of_measurements, sum_of_measurement_results);
+        else
+            predictor.accumulate_observable_buckets(chunk, observable_set, 0, chunk.number_of_shots, bucket_number_of_measurements, bucket_sum_of_measurement_results,
+                                                    (int)shot_offset, (int)reader.number_of_shots);
+        shots_read += chunk.number_of_shots;
+    });
+    shadow_predictor::add_observable_buckets(bucket_number_of_measurements, bucket_sum_of_measurement_results, number_of_measurements, sum_of_measurement_results);
+    shadow_profile::instance().add_counter("shots", (double)shots_read);
+    profile_observable_counters(observable_set, shots_read, number_of_measurements);
+    output_observables(observable_set, shots_read, number_of_measurements, sum_of_measurement_results,
+                       bucket_number_of_measurements, bucket_sum_of_measurement_results);
+}
+
+//
+// The following functions answer queries on measurements that are read once and stay in memory (-q),
+// so that every query only costs the prediction itself.
+// Every query is one line:
+//   o [observable.txt], e [subsystem.txt], or H [hamiltonian.txt],
+// answered as -o, -e, or -H would answer with the file (and the same options).
+// Without a file name, the lines of the file follow the query up to a line: end
+// Every answer ends with the line [Done], after [Error: ...] if the query cannot be answered;
+// the line quit ends the queries, and the line shutdown also stops the server of a socket.
+//
+void answer_query(const shadow_measurement_set& measurements, char kind, shadow_text_file& query_file, FILE* output_file){
+    pauli_observable_set observable_set;
+    qubit_subsystem_set subsystems;
+
+    if(kind == 'o'){
+        read_observables(query_file, measurements.system_size, observable_set);
+        int number_of_unique_observables = observable_set.number_of_unique_observables;
+        vector<int> number_of_measurements(number_of_unique_observables, 0), sum_of_measurement_results(number_of_unique_observables, 0);
+        vector<vector<int> > bucket_number_of_measurements(predictor.number_of_buckets, vector<int>(number_of_unique_observables, 0));
+        vector<vector<int> > bucket_sum_of_measurement_results(predictor.number_of_buckets, vector<int>(number_of_unique_observables, 0));
+        if(predictor.number_of_buckets == 0)
+            predictor.accumulate_observables(measurements, observable_set, 0, measurements.number_of_shots, number_of_measurements, sum_of_measurement_results);
+        else{
+            predictor.accumulate_observable_buckets(measurements, observable_set, 0, measurements.number_of_shots,
+                                                    bucket_number_of_measurements, bucket_sum_of_measurement_results);
+            shadow_predictor::add_observable_buckets(bucket_number_of_measurements, bucket_sum_of_measurement_results, number_of_measurements, sum_of_measurement_results);
+        }
+        shadow_profile_phase phase("output");
+        print_observable_predictions(output_file, observable_set.unique_observable, number_of_measurements, sum_of_measurement_results, false,
+                                     bucket_number_of_measurements, bucket_sum_of_measurement_results);
+    }
+    else if(kind == 'H'){
+        if(!engine_is_given) predictor.observable_engine = "grouped";
+        read_observables(query_file, measurements.system_size, observable_set, true);
+        double energy, energy_variance;
+        predictor.predict_energy(measurements, observable_set, energy, energy_variance);
+        shadow_profile_phase phase("output");
+        fprintf(output_file, "%f %e\n", energy, energy_variance);
+    }
+    else{
+        read_subsystems(query_file, measurements.system_size, subsystems);
+        vector<double> predicted_entropies;
+        predictor.predict_entropies(measurements, subsystems, predicted_entropies);
+        shadow_profile_phase phase("output");
+        for(int s = 0; s < subsystems.size(); s++)
+            fprintf(output_file, "%f\n", predicted_entropies[s]);
     }
+}
 
-    // Read in the measurements line by line
-    string line;
-    int measurement_counter = 0;
-    while(getline(measurement_fstream, line)){
-        if(line == "\n" || line == "") continue;
-        istringstream single_line_stream(line);
+//
+// The following function removes the white space at both ends of the line.
+//
+string trimmed(const char* line){
+    const char* begin = line;
+    const char* end = line + strlen(line);
+    while(begin < end && isspace((unsigned char)*begin)) begin++;
+    while(end > begin && isspace((unsigned char)end[-1])) end--;
+    return string(begin, end);
+}
 
-        vector<int> empty_list;
-        measurement_pauli_basis.push_back(empty_list);
-        measurement_binary_outcome.push_back(empty_list);
-        for(int ith_qubit = 0; ith_qubit < system_size; ith_qubit++){
-            char pauli[10];
-            int binary_outcome;
-            single_line_stream >> pauli >> binary_outcome;
-            assert(binary_outcome == 1 || binary_outcome == -1);
+//
+// The following function answers the queries read from input_file on output_file until the end of input_file,
+// and returns true if the queries ask to shut the server down.
+//
+bool serve_queries(const shadow_measurement_set& measurements, FILE* input_file, FILE* output_file){
+    string observable_engine = predictor.observable_engine; // -H switches to the grouped engine for one query
+    char* line = NULL;
+    size_t line_capacity = 0;
+    bool shutdown = false;
+
+    while(getline(&line, &line_capacity, input_file) >= 0){
+        string query = trimmed(line);
+        if(query.empty()) continue;
+        if(query == "quit") break;
+        if(query == "shutdown"){
+            shutdown = true;
+            break;
+        }
 
-            measurement_pauli_basis[measurement_counter].push_back(pauli[0] - 'X');
-            measurement_binary_outcome[measurement_counter].push_back(binary_outcome);
+        bool end_of_session = false;
+        try{
+            shadow_profile_phase phase("query");
+            shadow_profile::instance().add_counter("queries", 1);
+            char kind = query[0];
+            if((kind != 'o' && kind != 'e' && kind != 'H') || (query.size() > 1 && !isspace((unsigned char)query[1])))
+                throw_shadow_error("the query \"%s\" should be o, e, or H followed by an optional file name.", query.c_str());
+
+            shadow_text_file query_file;
+            string query_text;
+            string query_file_name = trimmed(query.c_str() + 1);
+            if(!query_file_name.empty()) query_file.open(query_file_name.c_str());
+            else{
+                bool found_end = false;
+                while(!found_end && getline(&line, &line_capacity, input_file) >= 0){
+                    found_end = (trimmed(line) == "end");
+                    if(!found_end) query_text += line;
+                }
+                if(!found_end){
+                    end_of_session = true;
+                    throw_shadow_error("the lines of the query are not followed by a line: end");
+                }
+                query_file.assign("(query)", query_text.data(), query_text.data() + query_text.size());
+            }
+            answer_query(measurements, kind, query_file, output_file);
         }
+        catch(const shadow_error& error){
+            fprintf(output_file, "[Error: %s]\n", error.what());
+        }
+        predictor.observable_engine = observable_engine;
+        fprintf(output_file, "[Done]\n");
+        fflush(output_file);
+        if(end_of_session) break;
+    }
+    free(line);
+    return shutdown;
+}
 
-        measurement_counter ++;
+//
+// The following function answers the queries of the clients of the Unix socket: socket_name, one client after the other,
+// until a client asks to shut the server down.
+//
+void serve_query_socket(const shadow_measurement_set& measurements, const char* socket_name){
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(socket_name) >= sizeof(address.sun_path))
+        throw_shadow_error("the socket name \"%s\" is too long.", socket_name);
+    strcpy(address.sun_path, socket_name);
+
+    // A socket left behind by an earlier server is replaced, but any other file is kept
+    struct stat file_status;
+    if(lstat(socket_name, &file_status) == 0 && S_ISSOCK(file_status.st_mode)) unlink(socket_name);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(server < 0 || bind(server, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(server, 16) != 0){
+        if(server >= 0) close(server);
+        throw_shadow_error("the socket \"%s\" cannot be opened.", socket_name);
+    }
+    signal(SIGPIPE, SIG_IGN); // a client that leaves before its answer must not stop the server
+    fprintf(stderr, "Answering queries on \"%s\"\n", socket_name);
+
+    bool shutdown = false;
+    while(!shutdown){
+        int client = accept(server, NULL, NULL);
+        if(client < 0){
+            if(errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        int output_descriptor = dup(client);
+        FILE* input_file = fdopen(client, "r");
+        FILE* output_file = (output_descriptor >= 0)? fdopen(output_descriptor, "w"): NULL;
+        if(input_file != NULL && output_file != NULL) shutdown = serve_queries(measurements, input_file, output_file);
+
+        if(input_file != NULL) fclose(input_file);
+        else close(client);
+        if(output_file != NULL) fclose(output_file);
+        else if(output_descriptor >= 0) close(output_descriptor);
+    }
+    close(server);
+    unlink(socket_name);
+    if(!shutdown) throw_shadow_error("the socket \"%s\" stopped accepting clients.", socket_name);
+}
+
+//
+// The following function reads the optional arguments given after the input files (from argv[first_option] on).
+// Every option is a pair: --[name] [value]
+// The options of the predictor are passed on to shadow_predictor::set_option.
+//
+void read_all_options(int argc, char* argv[], int first_option){
+    for(int a = first_option; a < argc; a += 2){
+        if(a + 1 >= argc)
+            throw_shadow_error("the option \"%s\" requires a value.", argv[a]);
+
+        if(predictor.set_option(argv[a], argv[a+1])){
+            if(strcmp(argv[a], "--engine") == 0) engine_is_given = true;
+            continue;
+        }
+        else if(strcmp(argv[a], "--shots") == 0){
+            // --shots [first]:[last] reads the shots from first to last-1 (counting from 0)
+            char* separator = strchr(argv[a+1], ':');
+            first_measurement_shot = atoi(argv[a+1]);
+            if(separator != NULL && separator[1] != '\0') last_measurement_shot = atoi(separator + 1);
+            if(separator == NULL || first_measurement_shot < 0 || last_measurement_shot < first_measurement_shot)
+                throw_shadow_error("the option --shots should be given as [first]:[last].");
+        }
+        else if(strcmp(argv[a], "--every") == 0){
+            report_every_shots = atoll(argv[a+1]);
+        }
+        else if(strcmp(argv[a], "--interval") == 0){
+            report_interval = atof(argv[a+1]);
+        }
+        else if(strcmp(argv[a], "--accumulators") == 0){
+            accumulator_file_name = argv[a+1];
+        }
+        else if(strcmp(argv[a], "--chunk-memory") == 0){
+            chunk_memory = atoll(argv[a+1]) << 20;
+            if(chunk_memory <= 0)
+                throw_shadow_error("the chunk memory should be positive.");
+        }
+        else if(strcmp(argv[a], "--profile") == 0){
+            profile_file_name = argv[a+1];
+            shadow_profile::instance().enable();
+        }
+        else throw_shadow_error("the option \"%s\" is not supported.", argv[a]);
     }
 }
 
@@ -193,154 +626,232 @@ void read_all_measurements(char* measurement_file_name){
 //
 void print_usage(){
     fprintf(stderr, "Usage:\n");
-    fprintf(stderr, "./prediction_shadow -o [measurement.txt] [observable.txt]\n");
+    fprintf(stderr, "./prediction_shadow -o [measurement.txt] [observable.txt] [options]\n");
     fprintf(stderr, "    This option predicts the expectation of local observables.\n");
     fprintf(stderr, "    We would output the predicted value for each local observable given in [observable.txt]\n");
+    fprintf(stderr, "    --engine scalar|bitplane|grouped: process one shot at a time, 256 shots at a time,\n");
+    fprintf(stderr, "        or 256 shots at a time for the observables on the same qubits together (default: bitplane)\n");
+    fprintf(stderr, "    --threads [number]: split the shots across this many threads, 0 uses all cores (default: 1)\n");
+    fprintf(stderr, "    --buckets [number]: also print the standard error and the median of means over this many buckets of shots\n");
     fprintf(stderr, "<or>\n");
-    fprintf(stderr, "./prediction_shadow -e [measurement.txt] [subsystem.txt]\n");
+    fprintf(stderr, "./prediction_shadow -H [measurement.txt] [hamiltonian.txt] [options]\n");
+    fprintf(stderr, "    This option predicts the energy of a Hamiltonian, the sum of the local observables in [hamiltonian.txt]\n");
+    fprintf(stderr, "    times the coefficient at the end of every line (1 if it is omitted).\n");
+    fprintf(stderr, "    We would output the predicted energy and its variance on one line.\n");
+    fprintf(stderr, "    It accepts the options of -o; the engine is grouped by default,\n");
+    fprintf(stderr, "    and the variance is estimated over [--buckets] buckets of shots (default: 10)\n");
+    fprintf(stderr, "<or>\n");
+    fprintf(stderr, "./prediction_shadow -e [measurement.txt] [subsystem.txt] [options]\n");
     fprintf(stderr, "    This option predicts the Renyi entanglement entropy.\n");
     fprintf(stderr, "    We would output the predicted entropy for each subsystem given in [subsystem.txt]\n");
+    fprintf(stderr, "    --threads [number]: predict this many subsystems at the same time, 0 uses all cores (default: 1)\n");
+    fprintf(stderr, "    --memory-budget [MB]: the total memory of the subsystems predicted at the same time (default: 2048)\n");
+    fprintf(stderr, "    --entropy-engine auto|graycode|pairwise: enumerate the 2^k Pauli operators of every shot, or all pairs of shots (default: auto)\n");
+    fprintf(stderr, "        (different estimators; auto only uses pairwise for subsystems of more than 30 qubits)\n");
+    fprintf(stderr, "    --counts auto|dense|sparse: store all 4^k Pauli operators, or only the measured ones (default: auto)\n");
+    fprintf(stderr, "<or>\n");
+    fprintf(stderr, "./prediction_shadow -oe [measurement.txt] [observable.txt] [subsystem.txt] [options]\n");
+    fprintf(stderr, "    This option predicts the local observables and then the entanglement entropy with a single scan over the measurements.\n");
+    fprintf(stderr, "    It accepts the options of both -o and -e.\n");
+    fprintf(stderr, "<or>\n");
+    fprintf(stderr, "./prediction_shadow -so [measurement stream] [observable.txt] [options]\n");
+    fprintf(stderr, "./prediction_shadow -se [measurement stream] [subsystem.txt] [options]\n");
+    fprintf(stderr, "    These options read the measurements from a stream (\"-\" for stdin, or a FIFO) while they are being written,\n");
+    fprintf(stderr, "    and print [Prediction after T shots] followed by the predictions of -o or -e.\n");
+    fprintf(stderr, "    --every [number]: print the predictions every this many shots, 0 to disable (default: 10000)\n");
+    fprintf(stderr, "    --interval [seconds]: also print the predictions every this many seconds (default: 0, disabled)\n");
+    fprintf(stderr, "<or>\n");
+    fprintf(stderr, "./prediction_shadow -q [measurement.txt] [- | query.sock] [options]\n");
+    fprintf(stderr, "    This option reads the measurements once, and answers queries from stdin (\"-\") or the clients of a Unix socket.\n");
+    fprintf(stderr, "    Every query is a line \"o|e|H [file]\" answered as -o, -e, or -H with the file (and the same options),\n");
+    fprintf(stderr, "    or \"o|e|H\" followed by the lines of the file and a line \"end\". Every answer ends with the line [Done].\n");
+    fprintf(stderr, "    The line \"quit\" ends the queries, and \"shutdown\" also stops the socket.\n");
+    fprintf(stderr, "<or>\n");
+    fprintf(stderr, "./prediction_shadow -c [measurement.txt] [measurement.shadow]\n");
+    fprintf(stderr, "    This option converts the measurement data to the binary .shadow format.\n");
+    fprintf(stderr, "    Both -o and -e accept a .shadow file in place of [measurement.txt], which is loaded without parsing.\n");
+    fprintf(stderr, "Both -o and -e accept --chunk-memory [MB] to read [measurement.txt] in chunks that take at most this much memory\n");
+    fprintf(stderr, "    (for measurements larger than the memory), with the same predictions.\n");
+    fprintf(stderr, "Both -o and -e accept --accumulators [shard.acc] to write the accumulators instead of the predictions\n");
+    fprintf(stderr, "    (e.g., for a part of the shots on every node of a cluster).\n");
+    fprintf(stderr, "<or>\n");
+    fprintf(stderr, "./prediction_shadow -m [shard 1.acc] [shard 2.acc] ... [options]\n");
+    fprintf(stderr, "    This option merges the accumulators of -o or -e, and prints the predictions for all their shots together.\n");
+    fprintf(stderr, "    The shards should have the same number of --buckets, and the merged predictions use shards x buckets buckets.\n");
+    fprintf(stderr, "All options accept --shots [first]:[last] to only use the shots from first to last-1 (counting from 0),\n");
+    fprintf(stderr, "and --profile [profile.json] to write the time of every phase, counters, and the peak memory as JSON (\"-\" for stderr)\n");
     return;
 }
 
-int main(int argc, char* argv[]){
-    if(argc != 4){
+int run(int argc, char* argv[]){
+    // The mode -oe takes three input files, -m any number of them, and the other modes take two
+    int first_option = (argc >= 2 && strcmp(argv[1], "-oe") == 0)? 5: 4;
+    if(argc >= 2 && strcmp(argv[1], "-m") == 0)
+        for(first_option = 2; first_option < argc && strncmp(argv[first_option], "--", 2) != 0; first_option++);
+    if(argc < first_option || first_option == 2){
         print_usage();
         return -1;
     }
+    read_all_options(argc, argv, first_option);
+    if(accumulator_file_name != NULL && strcmp(argv[1], "-o") != 0 && strcmp(argv[1], "-e") != 0)
+        throw_shadow_error("--accumulators is only supported by -o and -e.");
+    if(chunk_memory > 0 && strcmp(argv[1], "-q") == 0)
+        throw_shadow_error("--chunk-memory is not supported by -q, which keeps the measurements in memory.");
+
+    shadow_measurement_set measurements;
+    pauli_observable_set observable_set; // observables to predict
+    qubit_subsystem_set subsystems; // subsystems to predict entropy
 
     //
     // Running the prediction of local observables
+    // (identical Pauli strings are predicted once and printed for every observable in the file)
     //
-    if(strcmp(argv[1], "-o") == 0){
-        read_all_measurements(argv[2]);
-        read_all_observables(argv[3]);
-
-        // For every observable,
-        // how many Pauli operators need to be matched to measure the observable
-        // in the current measurement repetition.
-        vector<int> how_many_pauli_to_match;
-        how_many_pauli_to_match.resize(number_of_observables);
-
-        // For every observable,
-        // store the measurement up to this single-qubit measurement.
-        vector<int> cumulative_measurement;
-        cumulative_measurement.resize(number_of_observables);
-
-        // For every observable,
+    if(chunk_memory > 0 && (strcmp(argv[1], "-o") == 0 || strcmp(argv[1], "-e") == 0)){
+        run_chunked_prediction(argv[2], argv[3], strcmp(argv[1], "-e") == 0);
+    }
+    else if(strcmp(argv[1], "-o") == 0){
+        read_measurements(argv[2], measurements);
+        read_observables(argv[3], measurements.system_size, observable_set);
+
+        // For every unique observable,
         // store the number of times it has been measured.
         vector<int> number_of_measurements;
-        number_of_measurements.resize(number_of_observables);
+        number_of_measurements.resize(observable_set.number_of_unique_observables);
 
-        // For every observable,
-        // store the number of times it has been measured.
+        // For every unique observable,
+        // store the sum of the measurement results.
         vector<int> sum_of_measurement_results;
-        sum_of_measurement_results.resize(number_of_observables);
-
-        // Run through the measurement data:
-        //    measurement_pauli_basis, measurement_binary_outcome
-        // to compute the local observables
-        for(int t = 0; t < (int)measurement_pauli_basis.size(); t++){
-            for(int i = 0; i < (int)observables.size(); i++){
-                how_many_pauli_to_match[i] = observables[i].size(); // initialize to k for k-local observable
-                cumulative_measurement[i] = 1; // initialize to 1
-            }
-
-            for(int ith_qubit = 0; ith_qubit < system_size; ith_qubit++){
-                int pauli = measurement_pauli_basis[t][ith_qubit];
-                int binary_outcome = measurement_binary_outcome[t][ith_qubit];
-                for(int i : observables_acting_on_ith_qubit[ith_qubit][pauli]){
-                    how_many_pauli_to_match[i] --;
-                    cumulative_measurement[i] *= binary_outcome;
-                }
-            }
-
-            for(int i = 0; i < (int)observables.size(); i++){
-                if(how_many_pauli_to_match[i] == 0){
-                    number_of_measurements[i] ++;
-                    sum_of_measurement_results[i] += cumulative_measurement[i];
-                }
-            }
+        sum_of_measurement_results.resize(observable_set.number_of_unique_observables);
+
+        vector<vector<int> > bucket_number_of_measurements(predictor.number_of_buckets, vector<int>(observable_set.number_of_unique_observables, 0));
+        vector<vector<int> > bucket_sum_of_measurement_results(predictor.number_of_buckets, vector<int>(observable_set.number_of_unique_observables, 0));
+        if(predictor.number_of_buckets == 0)
+            predictor.accumulate_observables(measurements, observable_set, 0, measurements.number_of_shots, number_of_measurements, sum_of_measurement_results);
+        else{
+            predictor.accumulate_observable_buckets(measurements, observable_set, 0, measurements.number_of_shots,
+                                                    bucket_number_of_measurements, bucket_sum_of_measurement_results);
+            shadow_predictor::add_observable_buckets(bucket_number_of_measurements, bucket_sum_of_measurement_results, number_of_measurements, sum_of_measurement_results);
         }
+        profile_observable_counters(observable_set, measurements.number_of_shots, number_of_measurements);
+        output_observables(observable_set, measurements.number_of_shots, number_of_measurements, sum_of_measurement_results,
+                           bucket_number_of_measurements, bucket_sum_of_measurement_results);
+    }
+    //
+    // Running the prediction of the energy of a Hamiltonian
+    // (the terms on the same qubits are evaluated together by the grouped engine)
+    //
+    else if(strcmp(argv[1], "-H") == 0){
+        if(!engine_is_given) predictor.observable_engine = "grouped";
+        read_measurements(argv[2], measurements);
+        read_observables(argv[3], measurements.system_size, observable_set, true);
+        shadow_profile::instance().add_counter("hamiltonian terms", observable_set.number_of_observables);
 
-        for(int i = 0; i < (int)observables.size(); i++){
-            if(number_of_measurements[i] == 0){
-                fprintf(stderr, "%d-th Observable is not measured at all\n", i+1);
-                printf("0\n");
-            }
-            else printf("%f\n", 1.0 * sum_of_measurement_results[i] / number_of_measurements[i]);
-        }
+        double energy, energy_variance;
+        predictor.predict_energy(measurements, observable_set, energy, energy_variance);
+
+        shadow_profile_phase phase("output");
+        printf("%f %e\n", energy, energy_variance);
     }
     //
     // Running the prediction of entanglement entropy
     //
     else if(strcmp(argv[1], "-e") == 0){
-        read_all_measurements(argv[2]);
-        read_all_subsystems(argv[3]);
-
-        for(int s = 0; s < (int)subsystems.size(); s++){
-            int subsystem_size = (int)subsystems[s].size();
-
-
-            for(int c = 0; c < (1 << (2 * subsystem_size)); c++){
-                renyi_sum_of_binary_outcome[c] = 0;
-                renyi_number_of_outcomes[c] = 0;
-            }
-
-            for(int t = 0; t < (int)measurement_pauli_basis.size(); t++){
-                long long encoding = 0, cumulative_outcome = 1;
-
-                renyi_sum_of_binary_outcome[0] += 1;
-                renyi_number_of_outcomes[0] += 1;
-
-                // Using gray code iteration over all 2^n possible outcomes
-                for(long long b = 1; b < (1 << subsystem_size); b++){
-                    long long change_i = __builtin_ctzll(b);
-                    long long index_in_original_system = subsystems[s][change_i];
-
-                    cumulative_outcome *= measurement_binary_outcome[t][index_in_original_system];
-                    encoding ^= (measurement_pauli_basis[t][index_in_original_system] + 1) << (2LL * change_i);
-
-                    renyi_sum_of_binary_outcome[encoding] += cumulative_outcome;
-                    renyi_number_of_outcomes[encoding] += 1;
-                }
-            }
-
-            int level_cnt[2 * subsystem_size], level_ttl[2 * subsystem_size];
-            for(int i = 0; i < subsystem_size + 1; i++){
-                level_cnt[i] = 0;
-                level_ttl[i] = 0;
-            }
-
-            for(long long c = 0; c < (1 << (2 * subsystem_size)); c++){
-                int nonId = 0;
-                for(int i = 0; i < subsystem_size; i++){
-                    nonId += ((c >> (2 * i)) & 3) != 0;
-                }
-                if(renyi_number_of_outcomes[c] >= 2)
-                    level_cnt[nonId] ++;
-                level_ttl[nonId] ++;
-            }
-
-            double predicted_entropy = 0;
-            for(long long c = 0; c < (1 << (2 * subsystem_size)); c++){
-                if(renyi_number_of_outcomes[c] <= 1) continue;
-
-                int nonId = 0;
-                for(int i = 0; i < subsystem_size; i++)
-                    nonId += ((c >> (2 * i)) & 3) != 0;
-
-                predicted_entropy += ((double)1.0) / (renyi_number_of_outcomes[c] * (renyi_number_of_outcomes[c] - 1)) * (renyi_sum_of_binary_outcome[c] * renyi_sum_of_binary_outcome[c] - renyi_number_of_outcomes[c]) / (1LL << subsystem_size) * level_ttl[nonId] / level_cnt[nonId];
-            }
+        read_measurements(argv[2], measurements);
+        read_subsystems(argv[3], measurements.system_size, subsystems);
+
+        // The accumulators to be written keep the counts of all the subsystems at the same time
+        if(accumulator_file_name != NULL){
+            vector<renyi_chain> chains;
+            vector<vector<renyi_counts_workspace> > workspaces;
+            start_renyi_accumulators(subsystems, chains, workspaces);
+            add_renyi_accumulators(measurements, chains, workspaces);
+            output_entropies(subsystems, measurements.number_of_shots, chains, workspaces);
+        }
+        else{
+            vector<double> predicted_entropies;
+            predictor.predict_entropies(measurements, subsystems, predicted_entropies);
 
-            printf("%f\n", -1.0 * log2(min(max(predicted_entropy, 1.0 / pow(2.0, subsystem_size)), 1.0 - 1e-9)));
+            shadow_profile_phase phase("output");
+            for(int s = 0; s < subsystems.size(); s++)
+                printf("%f\n", predicted_entropies[s]);
         }
     }
     //
+    // Running the prediction of local observables and entanglement entropy with a single scan
+    //
+    else if(strcmp(argv[1], "-oe") == 0){
+        read_measurements(argv[2], measurements);
+        read_observables(argv[3], measurements.system_size, observable_set);
+        read_subsystems(argv[4], measurements.system_size, subsystems);
+
+        int number_of_unique_observables = observable_set.number_of_unique_observables;
+        vector<int> number_of_measurements(number_of_unique_observables, 0), sum_of_measurement_results(number_of_unique_observables, 0);
+        vector<vector<int> > bucket_number_of_measurements(predictor.number_of_buckets, vector<int>(number_of_unique_observables, 0));
+        vector<vector<int> > bucket_sum_of_measurement_results(predictor.number_of_buckets, vector<int>(number_of_unique_observables, 0));
+        vector<double> predicted_entropies;
+        predictor.predict_observables_and_entropies(measurements, observable_set, subsystems, number_of_measurements, sum_of_measurement_results,
+                                                    bucket_number_of_measurements, bucket_sum_of_measurement_results, predicted_entropies);
+        shadow_predictor::add_observable_buckets(bucket_number_of_measurements, bucket_sum_of_measurement_results, number_of_measurements, sum_of_measurement_results);
+        profile_observable_counters(observable_set, measurements.number_of_shots, number_of_measurements);
+
+        shadow_profile_phase phase("output");
+        print_observable_predictions(stdout, observable_set.unique_observable, number_of_measurements, sum_of_measurement_results, true,
+                                     bucket_number_of_measurements, bucket_sum_of_measurement_results);
+        for(int s = 0; s < subsystems.size(); s++)
+            printf("%f\n", predicted_entropies[s]);
+    }
+    //
+    // Running the prediction while the measurements are being streamed
+    //
+    else if(strcmp(argv[1], "-so") == 0){
+        read_observables(argv[3], -1, observable_set);
+        run_streaming_prediction(argv[2], observable_set, subsystems, false);
+    }
+    else if(strcmp(argv[1], "-se") == 0){
+        read_subsystems(argv[3], -1, subsystems);
+        run_streaming_prediction(argv[2], observable_set, subsystems, true);
+    }
+    //
+    // Answering queries on the measurements in memory
+    //
+    else if(strcmp(argv[1], "-q") == 0){
+        read_measurements(argv[2], measurements);
+        if(strcmp(argv[3], "-") == 0) serve_queries(measurements, stdin, stdout);
+        else serve_query_socket(measurements, argv[3]);
+    }
+    //
+    // Merging the accumulator files of --accumulators
+    //
+    else if(strcmp(argv[1], "-m") == 0){
+        merge_accumulators(argv, 2, first_option);
+    }
+    //
+    // Converting the measurement data to the binary .shadow format
+    //
+    else if(strcmp(argv[1], "-c") == 0){
+        read_measurements(argv[2], measurements);
+        shadow_profile_phase phase("output");
+        write_shadow_file(argv[3], measurements.system_size, 3, measurements.number_of_shots, measurements.data);
+        fprintf(stderr, "Converted %d measurements on %d qubits to \"%s\"\n", measurements.number_of_shots, measurements.system_size, argv[3]);
+    }
+    //
     // None of the above holds (the input is invalid)
     //
     else{
         print_usage();
         return -1;
     }
+
+    if(profile_file_name != NULL) shadow_profile::instance().write_json(profile_file_name, argc, argv);
+    return 0;
+}
+
+int main(int argc, char* argv[]){
+    try{
+        return run(argc, argv);
+    }
+    catch(const shadow_error& error){
+        fprintf(stderr, "\n====\nError: %s\n====\n", error.what());
+        return -1;
+    }
 }
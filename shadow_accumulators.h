@@ -0,0 +1,364 @@
+//
+// This code is created by Hsin-Yuan Huang (https://momohuang.github.io/).
+// For more details, see the accompany paper:
+//  "Predicting Many Properties of a Quantum System from Very Few Measurements".
+//
+// The following accumulator files (.acc) keep the raw accumulators of prediction_shadow.cpp -o and -e
+// instead of the predictions, so that the shots of an experiment can be split into shards,
+// predicted on different machines, and merged afterwards (prediction_shadow -m).
+// All the accumulators are integers, and merging adds them up,
+// so the merged predictions do not depend on how the shots were split.
+//
+// An accumulator file starts with a header of 64 bytes (shadow_accumulator_header) followed by 64-bit integers:
+//   local observables: number_of_observables, number_of_unique_observables,
+//     the unique observable of every observable in the file,
+//     then for the total and every bucket: the number of measurements and the sum of the outcomes of every unique observable;
+//   entanglement entropy: number_of_subsystems, number_of_tables, the table of every subsystem,
+//     then for every table: the subsystem size, the number of entries,
+//     and (encoding, sum of binary outcomes, number of outcomes) for every Pauli operator that is measured.
+// The fingerprint of the observables (or subsystems) makes sure that only shards of the same input are merged.
+//
+#ifndef SHADOW_ACCUMULATORS_H
+#define SHADOW_ACCUMULATORS_H
+
+#include <stdio.h>
+#include <string.h>
+#include <climits>
+#include <string>
+#include <vector>
+#include "shadow_io.h"
+#include "shadow_observables.h"
+#include "shadow_prediction.h"
+
+const char SHADOW_ACCUMULATOR_MAGIC[8] = {'S', 'H', 'A', 'D', 'A', 'C', 'C', '\n'};
+const unsigned int SHADOW_ACCUMULATOR_VERSION = 1;
+const unsigned int SHADOW_ACCUMULATOR_OBSERVABLES = 1;
+const unsigned int SHADOW_ACCUMULATOR_ENTROPY = 2;
+
+struct shadow_accumulator_header{
+    char magic[8];
+    unsigned int version;
+    unsigned int byte_order; // SHADOW_FILE_BYTE_ORDER as written by the machine that created the file
+    unsigned int kind; // SHADOW_ACCUMULATOR_OBSERVABLES or SHADOW_ACCUMULATOR_ENTROPY
+    unsigned int system_size;
+    unsigned long long number_of_shots;
+    unsigned long long fingerprint;
+    unsigned int number_of_buckets;
+    char reserved[20];
+};
+static_assert(sizeof(shadow_accumulator_header) == 64, "the header of an accumulator file has 64 bytes");
+
+//
+// The following function computes the fingerprint (FNV-1a) of the observables, including the order of the file and the weights.
+//
+inline unsigned long long observable_fingerprint(const pauli_observable_set& observable_set){
+    unsigned long long hash = 14695981039346656037ULL;
+    auto mix = [&hash](long long value){ hash = (hash ^ (unsigned long long)value) * 1099511628211ULL; };
+    mix(observable_set.system_size);
+    for(int i = 0; i < observable_set.number_of_observables; i++){
+        int u = observable_set.unique_observable[i];
+        mix(observable_set.k_local(u));
+        for(int term = observable_set.term_offset[u]; term < observable_set.term_offset[u+1]; term++) mix(observable_set.term_code[term]);
+        unsigned long long weight_bits;
+        memcpy(&weight_bits, &observable_set.weight[u], sizeof(weight_bits));
+        mix((long long)weight_bits);
+    }
+    return hash;
+}
+
+inline unsigned long long subsystem_fingerprint(const qubit_subsystem_set& subsystems){
+    unsigned long long hash = 14695981039346656037ULL;
+    auto mix = [&hash](long long value){ hash = (hash ^ (unsigned long long)value) * 1099511628211ULL; };
+    mix(subsystems.system_size);
+    for(int s = 0; s < subsystems.size(); s++){
+        mix((long long)subsystems[s].size());
+        for(int qubit : subsystems[s]) mix(qubit);
+    }
+    return hash;
+}
+
+//
+// The counts of the Pauli operators measured on a subsystem, in increasing order of the encoding,
+// which can be merged and given to renyi_entropy_from_counts like the counts of renyi_counts_workspace.
+//
+struct renyi_count_list{
+    struct entry_type{
+        long long encoding, sum_of_binary_outcome, number_of_outcomes;
+    };
+    int subsystem_size;
+    std::vector<entry_type> entries;
+
+    void assign(int subsystem_size, const renyi_counts_workspace& workspace){
+        this->subsystem_size = subsystem_size;
+        entries.clear();
+        workspace.for_each_measured([this](long long c, double sum_of_binary_outcome, double number_of_outcomes){
+            entry_type entry = {c, (long long)sum_of_binary_outcome, (long long)number_of_outcomes};
+            entries.push_back(entry);
+        });
+    }
+
+    void merge(const renyi_count_list& other){
+        std::vector<entry_type> merged;
+        merged.reserve(entries.size() + other.entries.size());
+        size_t a = 0, b = 0;
+        while(a < entries.size() || b < other.entries.size()){
+            if(b == other.entries.size() || (a < entries.size() && entries[a].encoding < other.entries[b].encoding)) merged.push_back(entries[a++]);
+            else if(a == entries.size() || other.entries[b].encoding < entries[a].encoding) merged.push_back(other.entries[b++]);
+            else{
+                entry_type entry = entries[a++];
+                entry.sum_of_binary_outcome += other.entries[b].sum_of_binary_outcome;
+                entry.number_of_outcomes += other.entries[b++].number_of_outcomes;
+                merged.push_back(entry);
+            }
+        }
+        entries.swap(merged);
+    }
+
+    //
+    // The following function checks what merge and renyi_entropy_from_counts rely on:
+    // the encodings are Pauli operators on the subsystem (below 4^subsystem_size) in strictly increasing order,
+    // and the sum of the +1/-1 outcomes of every operator is at most its number of outcomes in absolute value (with the same parity).
+    //
+    bool is_valid() const{
+        long long number_of_encodings = 1LL << (2 * subsystem_size);
+        for(size_t i = 0; i < entries.size(); i++){
+            const entry_type& entry = entries[i];
+            if(entry.encoding < 0 || entry.encoding >= number_of_encodings || (i > 0 && entry.encoding <= entries[i-1].encoding)) return false;
+            if(entry.number_of_outcomes < 1 || entry.sum_of_binary_outcome > entry.number_of_outcomes || entry.sum_of_binary_outcome < -entry.number_of_outcomes
+               || (entry.number_of_outcomes - entry.sum_of_binary_outcome) % 2 != 0) return false;
+        }
+        return true;
+    }
+
+    template<class visitor>
+    void for_each_repeated(visitor visit) const{
+        for(const entry_type& entry : entries)
+            if(entry.number_of_outcomes >= 2) visit(entry.encoding, (double)entry.sum_of_binary_outcome, (double)entry.number_of_outcomes);
+    }
+};
+
+//
+// The following accumulators hold the state of a shard of -o or -e.
+//
+class shadow_accumulators{
+public:
+    unsigned int kind;
+    int system_size;
+    long long number_of_shots;
+    unsigned long long fingerprint;
+
+    // The local observables (kind == SHADOW_ACCUMULATOR_OBSERVABLES)
+    std::vector<int> unique_observable;
+    std::vector<long long> number_of_measurements, sum_of_measurement_results;
+    std::vector<std::vector<long long> > bucket_number_of_measurements, bucket_sum_of_measurement_results;
+    long long buckets_per_shard; // the buckets of every shard (the merged accumulators have the buckets of all the shards)
+
+    // The entanglement entropy (kind == SHADOW_ACCUMULATOR_ENTROPY)
+    std::vector<int> table_of_subsystem;
+    std::vector<renyi_count_list> tables;
+
+    void assign_observables(const pauli_observable_set& observable_set, long long number_of_shots,
+                            const std::vector<int>& number_of_measurements, const std::vector<int>& sum_of_measurement_results,
+                            const std::vector<std::vector<int> >& bucket_number_of_measurements, const std::vector<std::vector<int> >& bucket_sum_of_measurement_results){
+        kind = SHADOW_ACCUMULATOR_OBSERVABLES;
+        system_size = observable_set.system_size;
+        this->number_of_shots = number_of_shots;
+        fingerprint = observable_fingerprint(observable_set);
+        unique_observable = observable_set.unique_observable;
+        this->number_of_measurements.assign(number_of_measurements.begin(), number_of_measurements.end());
+        this->sum_of_measurement_results.assign(sum_of_measurement_results.begin(), sum_of_measurement_results.end());
+        this->bucket_number_of_measurements.clear();
+        this->bucket_sum_of_measurement_results.clear();
+        buckets_per_shard = (long long)bucket_number_of_measurements.size();
+        for(int b = 0; b < (int)bucket_number_of_measurements.size(); b++){
+            this->bucket_number_of_measurements.push_back(std::vector<long long>(bucket_number_of_measurements[b].begin(), bucket_number_of_measurements[b].end()));
+            this->bucket_sum_of_measurement_results.push_back(std::vector<long long>(bucket_sum_of_measurement_results[b].begin(), bucket_sum_of_measurement_results[b].end()));
+        }
+    }
+
+    //
+    // The tables are the prefixes of the chains, and every subsystem uses the table of its prefix.
+    //
+    void assign_entropy(const qubit_subsystem_set& subsystems, long long number_of_shots,
+                        const std::vector<renyi_chain>& chains, const std::vector<std::vector<renyi_counts_workspace> >& workspaces){
+        kind = SHADOW_ACCUMULATOR_ENTROPY;
+        system_size = subsystems.system_size;
+        this->number_of_shots = number_of_shots;
+        fingerprint = subsystem_fingerprint(subsystems);
+        buckets_per_shard = 0;
+        table_of_subsystem.assign(subsystems.size(), -1);
+        tables.clear();
+        for(int c = 0; c < (int)chains.size(); c++){
+            for(int m = 0; m < (int)chains[c].prefix_sizes.size(); m++){
+                for(int s : chains[c].subsystem_indices[m]) table_of_subsystem[s] = (int)tables.size();
+                tables.push_back(renyi_count_list());
+                tables.back().assign(chains[c].prefix_sizes[m], workspaces[c][m]);
+            }
+        }
+    }
+
+    //
+    // The following function adds the accumulators of another shard of the same input.
+    // The buckets of the shards are kept side by side, so the merged accumulators have the buckets of all the shards,
+    // which must have the same number of buckets.
+    //
+    void merge(const shadow_accumulators& other){
+        if(other.kind != kind || other.system_size != system_size || other.fingerprint != fingerprint
+           || other.unique_observable.size() != unique_observable.size() || other.number_of_measurements.size() != number_of_measurements.size()
+           || other.table_of_subsystem.size() != table_of_subsystem.size() || other.tables.size() != tables.size())
+            throw_shadow_error("the accumulator files are not shards of the same observables or subsystems.");
+        for(int t = 0; t < (int)tables.size(); t++){
+            if(other.tables[t].subsystem_size != tables[t].subsystem_size)
+                throw_shadow_error("the accumulator files are not shards of the same observables or subsystems.");
+        }
+        if(other.buckets_per_shard != buckets_per_shard)
+            throw_shadow_error("the accumulator files have %lld and %lld buckets, while the shards should have the same number of buckets.",
+                               buckets_per_shard, other.buckets_per_shard);
+        number_of_shots += other.number_of_shots;
+        for(int u = 0; u < (int)number_of_measurements.size(); u++){
+            number_of_measurements[u] += other.number_of_measurements[u];
+            sum_of_measurement_results[u] += other.sum_of_measurement_results[u];
+        }
+        bucket_number_of_measurements.insert(bucket_number_of_measurements.end(), other.bucket_number_of_measurements.begin(), other.bucket_number_of_measurements.end());
+        bucket_sum_of_measurement_results.insert(bucket_sum_of_measurement_results.end(), other.bucket_sum_of_measurement_results.begin(), other.bucket_sum_of_measurement_results.end());
+        for(int t = 0; t < (int)tables.size(); t++) tables[t].merge(other.tables[t]);
+    }
+
+    void write(const char* file_name) const{
+        shadow_accumulator_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SHADOW_ACCUMULATOR_MAGIC, sizeof(SHADOW_ACCUMULATOR_MAGIC));
+        header.version = SHADOW_ACCUMULATOR_VERSION;
+        header.byte_order = SHADOW_FILE_BYTE_ORDER;
+        header.kind = kind;
+        header.system_size = system_size;
+        header.number_of_shots = number_of_shots;
+        header.fingerprint = fingerprint;
+        header.number_of_buckets = (unsigned int)bucket_number_of_measurements.size();
+
+        FILE* file = fopen(file_name, "wb");
+        if(file == NULL)
+            throw_shadow_error("the output file \"%s\" cannot be created.", file_name);
+        bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+        auto put = [&](long long value){ written = written && fwrite(&value, sizeof(value), 1, file) == 1; };
+        auto put_all = [&](const std::vector<long long>& values){
+            written = written && fwrite(values.data(), sizeof(long long), values.size(), file) == values.size();
+        };
+
+        if(kind == SHADOW_ACCUMULATOR_OBSERVABLES){
+            put((long long)unique_observable.size());
+            put((long long)number_of_measurements.size());
+            put_all(std::vector<long long>(unique_observable.begin(), unique_observable.end()));
+            put_all(number_of_measurements);
+            put_all(sum_of_measurement_results);
+            for(int b = 0; b < (int)bucket_number_of_measurements.size(); b++){
+                put_all(bucket_number_of_measurements[b]);
+                put_all(bucket_sum_of_measurement_results[b]);
+            }
+        }
+        else{
+            put((long long)table_of_subsystem.size());
+            put((long long)tables.size());
+            put_all(std::vector<long long>(table_of_subsystem.begin(), table_of_subsystem.end()));
+            for(const renyi_count_list& table : tables){
+                put(table.subsystem_size);
+                put((long long)table.entries.size());
+                written = written && fwrite(table.entries.data(), sizeof(renyi_count_list::entry_type), table.entries.size(), file) == table.entries.size();
+            }
+        }
+        if(fclose(file) != 0 || !written)
+            throw_shadow_error("failed to write the output file \"%s\".", file_name);
+    }
+
+    void read(const char* file_name){
+        FILE* file = fopen(file_name, "rb");
+        if(file == NULL)
+            throw_shadow_error("the input file \"%s\" does not exist.", file_name);
+        shadow_accumulator_header header;
+        bool complete = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, SHADOW_ACCUMULATOR_MAGIC, sizeof(SHADOW_ACCUMULATOR_MAGIC)) == 0;
+        if(!complete){
+            fclose(file);
+            throw_shadow_error("the input file \"%s\" is not an accumulator file.", file_name);
+        }
+        if(header.version != SHADOW_ACCUMULATOR_VERSION || header.byte_order != SHADOW_FILE_BYTE_ORDER
+           || (header.kind != SHADOW_ACCUMULATOR_OBSERVABLES && header.kind != SHADOW_ACCUMULATOR_ENTROPY)){
+            fclose(file);
+            throw_shadow_error("the accumulator file \"%s\" has version %u, or was written on a machine with a different byte order.", file_name, header.version);
+        }
+        kind = header.kind;
+        system_size = (int)header.system_size;
+        number_of_shots = (long long)header.number_of_shots;
+        fingerprint = header.fingerprint;
+        buckets_per_shard = (kind == SHADOW_ACCUMULATOR_OBSERVABLES)? header.number_of_buckets: 0;
+
+        // Every count is checked against what is left in the file before memory is allocated for it
+        struct stat file_status;
+        long long bytes_left = (fstat(fileno(file), &file_status) == 0)? (long long)file_status.st_size - (long long)sizeof(header): 0;
+        auto get = [&](){
+            long long value = 0;
+            complete = complete && bytes_left >= (long long)sizeof(value) && fread(&value, sizeof(value), 1, file) == 1;
+            bytes_left -= sizeof(value);
+            return value;
+        };
+        auto get_all = [&](long long number_of_values, size_t value_size, void* values){
+            complete = complete && number_of_values >= 0 && number_of_values <= bytes_left / (long long)value_size
+                       && fread(values, value_size, number_of_values, file) == (size_t)number_of_values;
+            if(complete) bytes_left -= number_of_values * value_size;
+        };
+        auto get_vector = [&](long long number_of_values, std::vector<long long>& values){
+            values.clear();
+            if(!complete || number_of_values < 0 || number_of_values > bytes_left / (long long)sizeof(long long)) complete = false;
+            else{
+                values.resize(number_of_values);
+                get_all(number_of_values, sizeof(long long), values.data());
+            }
+        };
+
+        std::vector<long long> values;
+        if(kind == SHADOW_ACCUMULATOR_OBSERVABLES){
+            long long number_of_observables = get(), number_of_unique_observables = get();
+            get_vector(number_of_observables, values);
+            unique_observable.assign(values.begin(), values.end());
+            for(int u : unique_observable)
+                if(u < 0 || u >= number_of_unique_observables) complete = false;
+            get_vector(number_of_unique_observables, number_of_measurements);
+            get_vector(number_of_unique_observables, sum_of_measurement_results);
+            // Every bucket takes two values per unique observable (and nothing without observables, when the buckets are not kept)
+            long long bucket_bytes = complete? 2 * (long long)sizeof(long long) * number_of_unique_observables: 0;
+            long long number_of_buckets = (complete && bucket_bytes > 0)? header.number_of_buckets: 0;
+            if(bucket_bytes > 0 && number_of_buckets > bytes_left / bucket_bytes) complete = false;
+            bucket_number_of_measurements.assign(complete? number_of_buckets: 0, std::vector<long long>());
+            bucket_sum_of_measurement_results.assign(complete? number_of_buckets: 0, std::vector<long long>());
+            for(int b = 0; b < (int)bucket_number_of_measurements.size(); b++){
+                get_vector(number_of_unique_observables, bucket_number_of_measurements[b]);
+                get_vector(number_of_unique_observables, bucket_sum_of_measurement_results[b]);
+            }
+        }
+        else{
+            long long number_of_subsystems = get(), number_of_tables = get();
+            get_vector(number_of_subsystems, values);
+            table_of_subsystem.assign(values.begin(), values.end());
+            for(int t : table_of_subsystem)
+                if(t < 0 || t >= number_of_tables) complete = false;
+            // Every table takes at least its subsystem size and its number of entries
+            if(number_of_tables < 0 || number_of_tables > bytes_left / (2 * (long long)sizeof(long long))) complete = false;
+            tables.assign(complete? number_of_tables: 0, renyi_count_list());
+            for(renyi_count_list& table : tables){
+                long long subsystem_size = get();
+                table.subsystem_size = (int)subsystem_size;
+                long long number_of_entries = get();
+                if(!complete || subsystem_size < 0 || subsystem_size > 31 || number_of_entries < 0 || number_of_entries > bytes_left / (long long)sizeof(renyi_count_list::entry_type)) complete = false;
+                else{
+                    table.entries.resize(number_of_entries);
+                    get_all(number_of_entries, sizeof(renyi_count_list::entry_type), table.entries.data());
+                    if(complete && !table.is_valid()) complete = false;
+                }
+            }
+        }
+        fclose(file);
+        if(!complete || bytes_left != 0)
+            throw_shadow_error("the accumulator file \"%s\" is truncated or corrupted.", file_name);
+    }
+};
+
+#endif
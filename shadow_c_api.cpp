@@ -0,0 +1,235 @@
+//
+// This code is created by Hsin-Yuan Huang (https://momohuang.github.io/).
+// For more details, see the accompany paper:
+//  "Predicting Many Properties of a Quantum System from Very Few Measurements".
+//
+// The following functions implement the C interface of shadow_c_api.h on top of the library headers.
+// Every shadow_error (and any other exception) is caught at the boundary and kept for shadow_last_error,
+// since an exception must not cross into the calling language.
+//
+#include <string>
+#include <vector>
+#include <new>
+#include <exception>
+#include "shadow_io.h"
+#include "shadow_observables.h"
+#include "shadow_measurements.h"
+#include "shadow_prediction.h"
+#include "shadow_derandomization.h"
+#include "shadow_c_api.h"
+
+using namespace std;
+
+struct shadow_measurements{
+    shadow_measurement_set measurements;
+};
+struct shadow_observables{
+    pauli_observable_set observable_set;
+};
+struct shadow_subsystems{
+    qubit_subsystem_set subsystems;
+};
+struct shadow_predictor_handle{
+    shadow_predictor predictor;
+};
+struct shadow_derandomizer_handle{
+    shadow_derandomizer derandomizer;
+    vector<int> paulis;
+};
+
+static thread_local string last_error;
+
+//
+// The following function runs body() and returns its result,
+// or keeps the message of the exception and returns failure_value.
+//
+template<class result_type, class function_type>
+static result_type call_safely(result_type failure_value, function_type body){
+    try{
+        return body();
+    }
+    catch(const exception& error){
+        last_error = error.what();
+    }
+    catch(...){
+        last_error = "unknown error";
+    }
+    return failure_value;
+}
+
+const char* shadow_last_error(void){
+    return last_error.c_str();
+}
+
+shadow_measurements* shadow_measurements_read(const char* file_name){
+    return call_safely((shadow_measurements*)NULL, [&](){
+        shadow_measurements* handle = new shadow_measurements;
+        try{ handle->measurements.read(file_name); }
+        catch(...){ delete handle; throw; }
+        return handle;
+    });
+}
+
+shadow_measurements* shadow_measurements_parse(const char* text, size_t length){
+    return call_safely((shadow_measurements*)NULL, [&](){
+        shadow_measurements* handle = new shadow_measurements;
+        try{ handle->measurements.parse(text, length); }
+        catch(...){ delete handle; throw; }
+        return handle;
+    });
+}
+
+shadow_measurements* shadow_measurements_borrow(int system_size, int number_of_shots, const unsigned long long* packed_shots){
+    return call_safely((shadow_measurements*)NULL, [&](){
+        if(system_size <= 0 || number_of_shots < 0 || (number_of_shots > 0 && packed_shots == NULL))
+            throw_shadow_error("the borrowed measurements should have a positive system size and a non-negative number of shots.");
+        shadow_measurements* handle = new shadow_measurements;
+        handle->measurements.borrow(system_size, number_of_shots, packed_shots);
+        long long invalid_shot = handle->measurements.find_invalid_basis(packed_shots, number_of_shots, 3);
+        if(invalid_shot >= 0){
+            delete handle;
+            throw_shadow_error("the %lld-th borrowed shot has a qubit without a Pauli basis.", invalid_shot + 1);
+        }
+        return handle;
+    });
+}
+
+int shadow_measurements_system_size(const shadow_measurements* measurements){
+    return measurements->measurements.system_size;
+}
+
+int shadow_measurements_number_of_shots(const shadow_measurements* measurements){
+    return measurements->measurements.number_of_shots;
+}
+
+void shadow_measurements_free(shadow_measurements* measurements){
+    delete measurements;
+}
+
+shadow_observables* shadow_observables_read(const char* file_name, int read_weights){
+    return call_safely((shadow_observables*)NULL, [&](){
+        shadow_observables* handle = new shadow_observables;
+        try{ handle->observable_set.read(file_name, -1, read_weights != 0); }
+        catch(...){ delete handle; throw; }
+        return handle;
+    });
+}
+
+shadow_observables* shadow_observables_parse(const char* text, size_t length, int read_weights){
+    return call_safely((shadow_observables*)NULL, [&](){
+        shadow_observables* handle = new shadow_observables;
+        try{ handle->observable_set.parse(text, length, -1, read_weights != 0); }
+        catch(...){ delete handle; throw; }
+        return handle;
+    });
+}
+
+int shadow_observables_size(const shadow_observables* observables){
+    return observables->observable_set.number_of_observables;
+}
+
+void shadow_observables_free(shadow_observables* observables){
+    delete observables;
+}
+
+shadow_subsystems* shadow_subsystems_read(const char* file_name){
+    return call_safely((shadow_subsystems*)NULL, [&](){
+        shadow_subsystems* handle = new shadow_subsystems;
+        try{ handle->subsystems.read(file_name, -1); }
+        catch(...){ delete handle; throw; }
+        return handle;
+    });
+}
+
+shadow_subsystems* shadow_subsystems_parse(const char* text, size_t length){
+    return call_safely((shadow_subsystems*)NULL, [&](){
+        shadow_subsystems* handle = new shadow_subsystems;
+        try{ handle->subsystems.parse(text, length, -1); }
+        catch(...){ delete handle; throw; }
+        return handle;
+    });
+}
+
+int shadow_subsystems_size(const shadow_subsystems* subsystems){
+    return subsystems->subsystems.size();
+}
+
+void shadow_subsystems_free(shadow_subsystems* subsystems){
+    delete subsystems;
+}
+
+shadow_predictor_handle* shadow_predictor_new(void){
+    return call_safely((shadow_predictor_handle*)NULL, [&](){
+        return new shadow_predictor_handle;
+    });
+}
+
+int shadow_predictor_set_option(shadow_predictor_handle* predictor, const char* name, const char* value){
+    return call_safely(-1, [&](){
+        if(!predictor->predictor.set_option(name, value))
+            throw_shadow_error("the option \"%s\" is not supported.", name);
+        return 0;
+    });
+}
+
+int shadow_predict_observables(const shadow_predictor_handle* predictor, const shadow_measurements* measurements, const shadow_observables* observables,
+                               double* predictions, double* standard_errors, double* median_of_means){
+    return call_safely(-1, [&](){
+        vector<double> predicted_observables, observable_standard_errors, observable_median_of_means;
+        predictor->predictor.predict_observables(measurements->measurements, observables->observable_set, predicted_observables,
+                                                 (standard_errors != NULL)? &observable_standard_errors: NULL,
+                                                 (median_of_means != NULL)? &observable_median_of_means: NULL);
+        for(int i = 0; i < (int)predicted_observables.size(); i++){
+            predictions[i] = predicted_observables[i];
+            if(standard_errors != NULL) standard_errors[i] = observable_standard_errors[i];
+            if(median_of_means != NULL) median_of_means[i] = observable_median_of_means[i];
+        }
+        return 0;
+    });
+}
+
+int shadow_predict_entropies(const shadow_predictor_handle* predictor, const shadow_measurements* measurements, const shadow_subsystems* subsystems,
+                             double* predictions){
+    return call_safely(-1, [&](){
+        vector<double> predicted_entropies;
+        predictor->predictor.predict_entropies(measurements->measurements, subsystems->subsystems, predicted_entropies);
+        for(int s = 0; s < (int)predicted_entropies.size(); s++) predictions[s] = predicted_entropies[s];
+        return 0;
+    });
+}
+
+void shadow_predictor_free(shadow_predictor_handle* predictor){
+    delete predictor;
+}
+
+shadow_derandomizer_handle* shadow_derandomizer_new(const shadow_observables* observables, int number_of_measurements_per_observable, int number_of_threads){
+    return call_safely((shadow_derandomizer_handle*)NULL, [&](){
+        if(number_of_threads <= 0)
+            throw_shadow_error("the number of threads should be positive.");
+        shadow_derandomizer_handle* handle = new shadow_derandomizer_handle;
+        try{ handle->derandomizer.start(observables->observable_set, number_of_measurements_per_observable, number_of_threads); }
+        catch(...){ delete handle; throw; }
+        return handle;
+    });
+}
+
+int shadow_derandomizer_system_size(const shadow_derandomizer_handle* derandomizer){
+    return derandomizer->derandomizer.system_size;
+}
+
+int shadow_derandomizer_next_measurement(shadow_derandomizer_handle* derandomizer, char* paulis){
+    return call_safely(-1, [&](){
+        bool finished = derandomizer->derandomizer.next_measurement(derandomizer->paulis);
+        for(int ith_qubit = 0; ith_qubit < (int)derandomizer->paulis.size(); ith_qubit++)
+            paulis[ith_qubit] = (char)('X' + derandomizer->paulis[ith_qubit]);
+        return finished? 1: 0;
+    });
+}
+
+int shadow_derandomizer_number_satisfied(const shadow_derandomizer_handle* derandomizer){
+    return derandomizer->derandomizer.number_satisfied;
+}
+
+void shadow_derandomizer_free(shadow_derandomizer_handle* derandomizer){
+    delete derandomizer;
+}
@@ -0,0 +1,91 @@
+/*
+ * This code is created by Hsin-Yuan Huang (https://momohuang.github.io/).
+ * For more details, see the accompany paper:
+ *  "Predicting Many Properties of a Quantum System from Very Few Measurements".
+ *
+ * The following C interface exposes the measurement set, the observable set, the subsystem set,
+ * the predictor, and the derandomizer to other languages (e.g., Python through ctypes).
+ * It is built into a shared library with
+ *   g++ -std=c++0x -O3 -pthread -shared -fPIC shadow_c_api.cpp -o libshadow.so
+ *
+ * Every object is an opaque handle created by a *_read, *_parse, *_borrow, or *_new function,
+ * which returns NULL on failure, and released by the matching *_free function.
+ * The functions returning int return -1 on failure.
+ * After a failure, shadow_last_error() returns the message of the calling thread.
+ */
+#ifndef SHADOW_C_API_H
+#define SHADOW_C_API_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct shadow_measurements shadow_measurements;
+typedef struct shadow_observables shadow_observables;
+typedef struct shadow_subsystems shadow_subsystems;
+typedef struct shadow_predictor_handle shadow_predictor_handle;
+typedef struct shadow_derandomizer_handle shadow_derandomizer_handle;
+
+const char* shadow_last_error(void);
+
+/*
+ * Measurements from a text file or a .shadow file, from text in memory,
+ * or borrowed without copying from number_of_shots packed shots of 3 * ((system_size + 63) / 64) 64-bit words
+ * (the layout of the shots in a .shadow file, see shadow_measurements.h), which must outlive the handle.
+ */
+shadow_measurements* shadow_measurements_read(const char* file_name);
+shadow_measurements* shadow_measurements_parse(const char* text, size_t length);
+shadow_measurements* shadow_measurements_borrow(int system_size, int number_of_shots, const unsigned long long* packed_shots);
+int shadow_measurements_system_size(const shadow_measurements* measurements);
+int shadow_measurements_number_of_shots(const shadow_measurements* measurements);
+void shadow_measurements_free(shadow_measurements* measurements);
+
+/*
+ * Observables in the format of [observable.txt]; with read_weights != 0 the optional weight of every line is read.
+ */
+shadow_observables* shadow_observables_read(const char* file_name, int read_weights);
+shadow_observables* shadow_observables_parse(const char* text, size_t length, int read_weights);
+int shadow_observables_size(const shadow_observables* observables);
+void shadow_observables_free(shadow_observables* observables);
+
+/*
+ * Subsystems in the format of [subsystem.txt].
+ */
+shadow_subsystems* shadow_subsystems_read(const char* file_name);
+shadow_subsystems* shadow_subsystems_parse(const char* text, size_t length);
+int shadow_subsystems_size(const shadow_subsystems* subsystems);
+void shadow_subsystems_free(shadow_subsystems* subsystems);
+
+/*
+ * The predictor takes the options of prediction_shadow, e.g. shadow_predictor_set_option(predictor, "--threads", "4").
+ * shadow_predict_observables writes one prediction for every observable (shadow_observables_size entries);
+ * standard_errors and median_of_means may be NULL, otherwise they receive the error bars over the buckets of "--buckets".
+ * shadow_predict_entropies writes one prediction for every subsystem (shadow_subsystems_size entries).
+ */
+shadow_predictor_handle* shadow_predictor_new(void);
+int shadow_predictor_set_option(shadow_predictor_handle* predictor, const char* name, const char* value);
+int shadow_predict_observables(const shadow_predictor_handle* predictor, const shadow_measurements* measurements, const shadow_observables* observables,
+                               double* predictions, double* standard_errors, double* median_of_means);
+int shadow_predict_entropies(const shadow_predictor_handle* predictor, const shadow_measurements* measurements, const shadow_subsystems* subsystems,
+                             double* predictions);
+void shadow_predictor_free(shadow_predictor_handle* predictor);
+
+/*
+ * The derandomizer chooses Pauli measurements that measure every observable (read with weights)
+ * at least floor(weight * number_of_measurements_per_observable) times.
+ * shadow_derandomizer_next_measurement writes 'X', 'Y', or 'Z' for every qubit to paulis (system_size characters),
+ * and returns 1 once every observable is measured enough times, 0 otherwise.
+ */
+shadow_derandomizer_handle* shadow_derandomizer_new(const shadow_observables* observables, int number_of_measurements_per_observable, int number_of_threads);
+int shadow_derandomizer_system_size(const shadow_derandomizer_handle* derandomizer);
+int shadow_derandomizer_next_measurement(shadow_derandomizer_handle* derandomizer, char* paulis);
+int shadow_derandomizer_number_satisfied(const shadow_derandomizer_handle* derandomizer);
+void shadow_derandomizer_free(shadow_derandomizer_handle* derandomizer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
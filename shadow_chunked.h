@@ -0,0 +1,202 @@
+//
+// This code is created by Hsin-Yuan Huang (https://momohuang.github.io/).
+// For more details, see the accompany paper:
+//  "Predicting Many Properties of a Quantum System from Very Few Measurements".
+//
+// The following reader goes through a measurement file (text or .shadow) that does not need to fit in memory,
+// for the option --chunk-memory of prediction_shadow.cpp.
+// A reader thread parses chunks of shots into a ring of reusable measurement sets,
+// while the calling thread hands the chunks, in the order of the file, to the accumulators.
+// The memory of the shots is bounded by the ring, so reading and computing overlap
+// and the run takes about the longer of the two instead of their sum.
+//
+#ifndef SHADOW_CHUNKED_H
+#define SHADOW_CHUNKED_H
+
+#include <climits>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include "shadow_io.h"
+#include "shadow_measurements.h"
+#include "shadow_prediction.h"
+#include "shadow_profile.h"
+
+class shadow_chunked_reader{
+public:
+    //
+    // One chunk is being filled, one is being used, and one is ready in between.
+    //
+    static const int RING_SIZE = 3;
+
+    int system_size;
+    long long number_of_shots; // -1 for a text file, whose number of shots is only known at the end
+    int chunk_shots;
+
+    //
+    // The following function opens the file: measurement_file_name, and chooses chunks of a whole number of bit-plane tiles
+    // such that the ring takes at most memory_budget bytes.
+    // If system_size is -1, the system size is taken from the file.
+    // Only the shots from first_shot to last_shot-1 (counting from 0) are read.
+    //
+    void open(const char* measurement_file_name, int system_size, long long first_shot, long long last_shot, long long memory_budget){
+        is_binary = is_shadow_file(measurement_file_name);
+        file_name = measurement_file_name;
+        this->first_shot = first_shot;
+        this->last_shot = last_shot;
+        int system_size_measurement;
+        if(is_binary){
+            binary_file.open(measurement_file_name, first_shot, last_shot);
+            if(binary_file.header.planes_per_shot != 3)
+                throw_shadow_error("the .shadow file \"%s\" contains measurement bases without outcomes.", measurement_file_name);
+            system_size_measurement = (int)binary_file.header.system_size;
+            number_of_shots = binary_file.size();
+        }
+        else{
+            text_stream.open(measurement_file_name);
+            lines.assign(measurement_file_name, NULL, NULL);
+            if(!next_text_line()) lines.report_malformed("the system size");
+            system_size_measurement = lines.read_int("the system size");
+            number_of_shots = -1;
+            shot_in_file = 0;
+        }
+        if(system_size == -1) system_size = system_size_measurement;
+        if(system_size_measurement != system_size)
+            throw_shadow_error("the system size do not match.");
+        this->system_size = system_size;
+
+        long long shot_bytes = 3LL * ((system_size + 63) / 64) * sizeof(unsigned long long);
+        long long tiles_per_chunk = memory_budget / (RING_SIZE * shot_bytes * BITPLANE_TILE_SHOTS);
+        if(tiles_per_chunk < 1)
+            throw_shadow_error("the chunk memory should hold at least %d shots.", RING_SIZE * BITPLANE_TILE_SHOTS);
+        chunk_shots = (int)std::min(tiles_per_chunk * BITPLANE_TILE_SHOTS, (long long)INT_MAX / 2 / BITPLANE_TILE_SHOTS * BITPLANE_TILE_SHOTS);
+    }
+
+    //
+    // The following function calls consume(chunk, shot_offset) on the calling thread for every chunk in the order of the file,
+    // where the shots of the chunk are the shots shot_offset, shot_offset+1, ... of the range that is read.
+    // A shadow_error of the reader thread is thrown here, after the chunks before it have been used.
+    //
+    template<class consume_function>
+    void for_each_chunk(consume_function consume){
+        std::vector<shadow_measurement_set> ring(RING_SIZE);
+        for(auto& chunk : ring) chunk.start_batches(system_size, chunk_shots);
+        std::vector<long long> ring_offset(RING_SIZE, 0);
+        long long chunks_read = 0, chunks_used = 0;
+        bool reader_finished = false, consumer_stopped = false;
+        std::string read_error;
+        std::mutex ring_mutex;
+        std::condition_variable ring_changed;
+
+        std::thread reader([&](){
+            long long shot_offset = 0;
+            try{
+                while(true){
+                    {
+                        std::unique_lock<std::mutex> lock(ring_mutex);
+                        ring_changed.wait(lock, [&](){ return consumer_stopped || chunks_read - chunks_used < RING_SIZE; });
+                        if(consumer_stopped) break;
+                    }
+                    shadow_measurement_set& chunk = ring[chunks_read % RING_SIZE];
+                    chunk.clear_shots();
+                    {
+                        shadow_profile_phase phase("read chunk", true);
+                        read_chunk(chunk, shot_offset);
+                    }
+                    if(chunk.number_of_shots == 0) break;
+                    if(shot_offset + chunk.number_of_shots > INT_MAX)
+                        throw_shadow_error("the measurements hold more than %d shots.", INT_MAX);
+
+                    std::lock_guard<std::mutex> lock(ring_mutex);
+                    ring_offset[chunks_read % RING_SIZE] = shot_offset;
+                    shot_offset += chunk.number_of_shots;
+                    chunks_read ++;
+                    ring_changed.notify_all();
+                }
+            }
+            catch(const shadow_error& error){
+                read_error = error.what();
+            }
+            std::lock_guard<std::mutex> lock(ring_mutex);
+            reader_finished = true;
+            ring_changed.notify_all();
+        });
+
+        try{
+            while(true){
+                {
+                    shadow_profile_phase phase("wait for chunk");
+                    std::unique_lock<std::mutex> lock(ring_mutex);
+                    ring_changed.wait(lock, [&](){ return reader_finished || chunks_used < chunks_read; });
+                    if(chunks_used == chunks_read) break;
+                }
+                consume((const shadow_measurement_set&)ring[chunks_used % RING_SIZE], ring_offset[chunks_used % RING_SIZE]);
+                shadow_profile::instance().add_counter("chunks", 1);
+
+                std::lock_guard<std::mutex> lock(ring_mutex);
+                chunks_used ++;
+                ring_changed.notify_all();
+            }
+        }
+        catch(...){
+            {
+                std::lock_guard<std::mutex> lock(ring_mutex);
+                consumer_stopped = true;
+                ring_changed.notify_all();
+            }
+            reader.join();
+            throw;
+        }
+        reader.join();
+        if(!read_error.empty()) throw shadow_error(read_error);
+    }
+
+private:
+    std::string file_name;
+    bool is_binary;
+    long long first_shot, last_shot;
+
+    // The .shadow file, of which the shots already copied into a chunk are released
+    shadow_binary_file binary_file;
+
+    // The text file, of which [lines] holds the complete lines received so far
+    shadow_text_stream text_stream;
+    shadow_text_file lines;
+    long long shot_in_file;
+
+    bool next_text_line(){
+        while(!lines.next_line()){
+            if(!text_stream.receive(-1, lines)) return false;
+        }
+        return true;
+    }
+
+    //
+    // The following function fills the chunk with the shots that follow shot_offset (all of them read already).
+    //
+    void read_chunk(shadow_measurement_set& chunk, long long shot_offset){
+        if(is_binary){
+            int count = (int)std::min((long long)chunk.batch_size(), number_of_shots - shot_offset);
+            if(count <= 0) return;
+            size_t shot_words = 3 * (size_t)chunk.words_per_plane;
+            const unsigned long long* shots = binary_file.shots() + (size_t)shot_offset * shot_words;
+            unsigned long long* chunk_shots = chunk.append_shots(count);
+            std::copy(shots, shots + count * shot_words, chunk_shots);
+            long long invalid_shot = chunk.find_invalid_basis(chunk_shots, count, 3);
+            if(invalid_shot >= 0)
+                throw_shadow_error("the %lld-th shot of the .shadow file \"%s\" has a qubit without a Pauli basis.",
+                                   first_shot + shot_offset + invalid_shot + 1, file_name.c_str());
+            binary_file.release_shots(shot_offset, shot_offset + count);
+            return;
+        }
+        while(chunk.number_of_shots < chunk.batch_size() && shot_in_file < last_shot && next_text_line()){
+            if(shot_in_file++ < first_shot) continue;
+            chunk.append_line(lines);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,385 @@
+//
+// This code is created by Hsin-Yuan Huang (https://momohuang.github.io/).
+// For more details, see the accompany paper:
+//  "Predicting Many Properties of a Quantum System from Very Few Measurements".
+//
+// The following derandomizer chooses the Pauli measurements of the derandomized classical shadows
+// one measurement repetition at a time; data_acquisition_shadow.cpp is a command line program around it.
+// All the state of the derandomization lives in the object, so several derandomizers can run in one process.
+//
+#ifndef SHADOW_DERANDOMIZATION_H
+#define SHADOW_DERANDOMIZATION_H
+
+#include <cmath>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <atomic>
+#include "shadow_io.h"
+#include "shadow_observables.h"
+#include "shadow_measurements.h"
+#include "shadow_prediction.h"
+#include "shadow_profile.h"
+#include "shadow_threads.h"
+
+class shadow_derandomizer{
+public:
+    static const int INF = 999999999; // This is a very large number we call infinity
+
+    // The loops are only split across threads when they have at least this many iterations,
+    // since waking up the threads takes some microseconds.
+    static const int PARALLEL_LOOP_MIN_SIZE = 2048;
+
+    //
+    // The following function starts the derandomization for the observables in [observables],
+    // which should each be measured floor(weight * number_of_measurements_per_observable) times.
+    // The observable set is moved into the derandomizer, since its inverted index shrinks as the observables are satisfied.
+    // eta is a hyperparameter that should be tuned.
+    //
+    void start(pauli_observable_set observables, int number_of_measurements_per_observable, int number_of_threads = 1, double eta = 0.9){
+        shadow_profile_phase phase("derandomization start");
+        observable_set = std::move(observables);
+        this->number_of_measurements_per_observable = number_of_measurements_per_observable;
+        this->eta = eta;
+        system_size = observable_set.system_size;
+        number_of_repetitions = 0;
+        number_of_exp_calls = 0;
+
+        //
+        // Precompute some constants for efficient usage in the derandomization process
+        //
+        double expm1eta = expm1(-eta / 2); // expm1eta = e^(-eta / 2) - 1
+        log1ppow1o3k.clear();
+        for(int k = 0; k < observable_set.max_k_local+1; k++){
+            log1ppow1o3k.push_back(log1p(pow(1.0/3.0, k) * expm1eta));
+        }
+        sum_log_value = 0.0;
+        sum_cnt = 0;
+
+        int number_of_unique_observables = observable_set.number_of_unique_observables;
+
+        // For every unique observable,
+        // how many times the observable has been measured
+        // in all previous measurement repetitions
+        cur_num_of_measurements.assign(number_of_unique_observables, 0); // initialize to zero
+
+        // For every unique observable,
+        // how many Pauli operators need to be matched to measure the observable
+        // in the current measurement repetition.
+        how_many_pauli_to_match.resize(number_of_unique_observables);
+
+        current_fail_prob.resize(number_of_unique_observables);
+        current_scaled_log.resize(number_of_unique_observables);
+        unmatched_fail_prob.resize(number_of_unique_observables);
+        unmatched_scaled_log.resize(number_of_unique_observables);
+
+        // The observables that are satisfied from the start are never active
+        number_satisfied = 0;
+        active_observables.clear();
+        for(int i = 0; i < number_of_unique_observables; i++){
+            if(is_satisfied(i)) number_satisfied += observable_set.multiplicity[i];
+            else active_observables.push_back(i);
+        }
+        observable_set.remove_from_index([this](int i){ return is_satisfied(i); });
+        size_t longest_acting_lists = 0;
+        for(int ith_qubit = 0; ith_qubit < system_size; ith_qubit++)
+            longest_acting_lists = std::max(longest_acting_lists, (size_t)(observable_set.acting_end(ith_qubit, 2) - observable_set.acting_begin(ith_qubit, 0)));
+        matched_fail_prob.resize(longest_acting_lists);
+        matched_scaled_log.resize(longest_acting_lists);
+
+        derandomization_pool.stop();
+        derandomization_pool.start(number_of_threads);
+    }
+
+    ~shadow_derandomizer(){
+        derandomization_pool.stop();
+    }
+
+    //
+    // The following function chooses the next Pauli measurement (X -> 0, Y -> 1, Z -> 2 for every qubit),
+    // and returns true once every observable has been measured enough times.
+    //
+    bool next_measurement(std::vector<int>& paulis){
+        shadow_profile_phase phase("derandomization repetition");
+        double shift = (sum_cnt == 0)? 0: sum_log_value / sum_cnt;
+        sum_log_value = 0.0;
+        sum_cnt = 0;
+
+        start_measurement_repetition(shift);
+
+        paulis.resize(system_size);
+        for(int ith_qubit = 0; ith_qubit < system_size; ith_qubit++)
+            paulis[ith_qubit] = choose_pauli_for_ith_qubit(ith_qubit, shift);
+
+        //
+        // Check the number of measurements for all the observables
+        //
+        number_satisfied += end_measurement_repetition();
+        number_of_repetitions ++;
+        return finished();
+    }
+
+    bool finished() const{
+        return number_satisfied == observable_set.number_of_observables;
+    }
+
+    //
+    // The following function credits the measurements of an existing scheme, e.g., the rows of a checkpoint
+    // or a scheme planned earlier for other observables, as if they had been chosen by this derandomizer.
+    // The rows that measure every observable are counted in one bulk pass with the bit-plane engine of shadow_predictor,
+    // and the next measurement continues after them.
+    //
+    void credit_scheme(const shadow_measurement_set& scheme){
+        shadow_profile_phase phase("derandomization credit");
+        if(scheme.system_size != system_size)
+            throw_shadow_error("the system size do not match.");
+
+        int number_of_unique_observables = observable_set.number_of_unique_observables;
+        std::vector<int> number_of_matches(number_of_unique_observables, 0), sum_of_outcomes(number_of_unique_observables, 0);
+        shadow_predictor match_counter;
+        match_counter.number_of_threads = derandomization_pool.size();
+        match_counter.accumulate_observables(scheme, observable_set, 0, scheme.number_of_shots, number_of_matches, sum_of_outcomes);
+
+        for(int i : active_observables){
+            cur_num_of_measurements[i] += number_of_matches[i];
+            if(is_satisfied(i)) number_satisfied += observable_set.multiplicity[i];
+        }
+        remove_satisfied_observables();
+        number_of_repetitions += scheme.number_of_shots;
+    }
+
+    //
+    // The shift of the next measurement is the average of the scaled log values over the previous one (sum_log_value / sum_cnt).
+    // It is saved with a checkpoint and restored after credit_scheme, so that a resumed run chooses exactly the same measurements.
+    //
+    void get_shift_statistics(double& sum_log_value, int& sum_cnt) const{
+        sum_log_value = this->sum_log_value;
+        sum_cnt = this->sum_cnt;
+    }
+    void set_shift_statistics(double sum_log_value, int sum_cnt){
+        this->sum_log_value = sum_log_value;
+        this->sum_cnt = sum_cnt;
+    }
+
+    int system_size;
+    int number_of_repetitions; // the number of measurements chosen so far
+    int number_satisfied; // the number of observables in the file that are measured enough times
+    std::atomic<long long> number_of_exp_calls; // the number of exp() in fail_prob_pessimistic so far
+
+private:
+    pauli_observable_set observable_set;
+    int number_of_measurements_per_observable;
+    double eta;
+    parallel_loop_pool derandomization_pool;
+
+    //
+    // The following functions perform multiplicative weight update,
+    // which is used in derandomizing the random Pauli measurement for classical shadows.
+    //
+    // The pessimistic estimator of the failure probability of an observable that is not yet satisfied is
+    //   2 exp(log_value / weight - shift),
+    //   log_value = -eta / 2 * cur_num_of_measurements + log1ppow1o3k[how_many_pauli_to_match],
+    // where shift is the average of log_value / weight over the previous measurement repetition.
+    //
+    std::vector<double> log1ppow1o3k; // log1ppow1o3k[k] = log(1 + (e^(-eta / 2) - 1) / 3^k)
+    double sum_log_value;
+    int sum_cnt;
+    inline double scaled_log_value(int cur_num_of_measurements, int how_many_pauli_to_match, double weight) const{
+        double log1pp0 = (how_many_pauli_to_match < INF? log1ppow1o3k[how_many_pauli_to_match] : 0.0);
+        double log_value = -eta / 2 * cur_num_of_measurements + log1pp0;
+        return log_value / weight;
+    }
+    static inline double fail_prob_pessimistic(double scaled_log_value, double shift){ // stands for "failure probability by pessimistic estimator"
+        return 2 * exp(scaled_log_value - shift);
+    }
+
+    //
+    // The derandomization keeps the following state for every unique observable.
+    // Only the observables that are not yet satisfied are active:
+    // they are listed in [active_observables] and in the inverted index of [observable_set],
+    // and the satisfied observables are removed from both at the end of a repetition.
+    //
+    // Within a repetition, shift and cur_num_of_measurements are fixed,
+    // so the failure probabilities only change when how_many_pauli_to_match changes.
+    // They are cached in [current_fail_prob] (the current step) and [unmatched_fail_prob]
+    // (the observable can no longer be matched in this repetition),
+    // together with their scaled log values, which are needed for the shift of the next repetition.
+    //
+    std::vector<int> cur_num_of_measurements; // stands for "current number of measurements"
+    std::vector<int> how_many_pauli_to_match;
+    std::vector<int> active_observables;
+    std::vector<double> current_fail_prob, current_scaled_log;
+    std::vector<double> unmatched_fail_prob, unmatched_scaled_log;
+
+    inline bool is_satisfied(int i) const{
+        return floor(observable_set.weight[i] * number_of_measurements_per_observable) <= cur_num_of_measurements[i];
+    }
+
+    //
+    // The following function starts a new measurement repetition for all the active observables.
+    //
+    void start_measurement_repetition(double shift){
+        auto start_observables = [this, shift](int begin, int end){
+            for(int a = begin; a < end; a++){
+                int i = active_observables[a];
+                how_many_pauli_to_match[i] = observable_set.k_local(i); // initialize to k for k-local observable
+                current_scaled_log[i] = scaled_log_value(cur_num_of_measurements[i], how_many_pauli_to_match[i], observable_set.weight[i]);
+                current_fail_prob[i] = fail_prob_pessimistic(current_scaled_log[i], shift);
+                unmatched_scaled_log[i] = scaled_log_value(cur_num_of_measurements[i], INF, observable_set.weight[i]);
+                unmatched_fail_prob[i] = fail_prob_pessimistic(unmatched_scaled_log[i], shift);
+            }
+        };
+
+        int number_of_active_observables = (int)active_observables.size();
+        number_of_exp_calls += 2LL * number_of_active_observables;
+        if(number_of_active_observables >= PARALLEL_LOOP_MIN_SIZE)
+            derandomization_pool.run(number_of_active_observables, start_observables);
+        else
+            start_observables(0, number_of_active_observables);
+    }
+
+    //
+    // The following function chooses the Pauli measurement for ith_qubit
+    // with the smallest pessimistic estimate of the failure probability,
+    // and updates the state of the active observables acting on ith_qubit.
+    //
+    // The failure probabilities of the next step (when the Pauli operator is matched)
+    // are stored in [matched_fail_prob] and [matched_scaled_log] for every entry of
+    // the inverted index for (ith_qubit, X), (ith_qubit, Y), (ith_qubit, Z), which are stored one after another.
+    // Computing them is the expensive part (one exp for every entry), and every entry is independent,
+    // so they are computed in parallel. The sums below stay in a fixed order on a single thread,
+    // which makes the chosen Pauli measurements identical for any number of threads.
+    // A unique observable with multiplicity m contributes m times to the sums.
+    //
+    std::vector<double> matched_fail_prob, matched_scaled_log;
+
+    int choose_pauli_for_ith_qubit(int ith_qubit, double shift){
+        const int* acting_entries = observable_set.acting_begin(ith_qubit, 0);
+        const int* acting_lists_end[3];
+        for(int p = 0; p < 3; p++) acting_lists_end[p] = observable_set.acting_end(ith_qubit, p);
+        int number_of_entries = (int)(acting_lists_end[2] - acting_entries);
+
+        auto compute_matched_fail_prob = [this, acting_entries, shift](int begin, int end){
+            long long exp_calls = 0;
+            for(int entry = begin; entry < end; entry++){
+                int i = acting_entries[entry];
+                if(how_many_pauli_to_match[i] == INF){
+                    matched_scaled_log[entry] = unmatched_scaled_log[i];
+                    matched_fail_prob[entry] = unmatched_fail_prob[i];
+                }
+                else{
+                    matched_scaled_log[entry] = scaled_log_value(cur_num_of_measurements[i], how_many_pauli_to_match[i]-1, observable_set.weight[i]);
+                    matched_fail_prob[entry] = fail_prob_pessimistic(matched_scaled_log[entry], shift);
+                    exp_calls ++;
+                }
+            }
+            number_of_exp_calls += exp_calls;
+        };
+        if(number_of_entries >= PARALLEL_LOOP_MIN_SIZE)
+            derandomization_pool.run(number_of_entries, compute_matched_fail_prob);
+        else
+            compute_matched_fail_prob(0, number_of_entries);
+
+        int entry;
+
+        //
+        // if we choose to measure pauli for ith_qubit in the current repetition
+        //
+        double prob_of_failure[3]; // for choosing X, Y, or Z
+        double smallest_prob_of_failure = -1;
+        for(int pauli = 0; pauli < 3; pauli ++){
+            prob_of_failure[pauli] = 0;
+
+            // for every Pauli observable p, we can calculate a score
+            // (the log values are summed in the same order as the estimates are evaluated)
+            entry = 0;
+            for(int p = 0; p < 3; p ++){
+                for(; entry < (int)(acting_lists_end[p] - acting_entries); entry++){
+                    int i = acting_entries[entry];
+                    int m = observable_set.multiplicity[i];
+                    if(pauli == p){
+                        sum_log_value += m * matched_scaled_log[entry];
+                        sum_log_value += m * current_scaled_log[i];
+                        prob_of_failure[pauli] += m * (matched_fail_prob[entry] - current_fail_prob[i]);
+                    }
+                    else{
+                        sum_log_value += m * unmatched_scaled_log[i];
+                        sum_log_value += m * current_scaled_log[i];
+                        prob_of_failure[pauli] += m * (unmatched_fail_prob[i] - current_fail_prob[i]);
+                    }
+                    sum_cnt += 2 * m;
+                }
+            }
+
+            if(smallest_prob_of_failure == -1)
+                smallest_prob_of_failure = prob_of_failure[pauli];
+            else
+                smallest_prob_of_failure = std::min(smallest_prob_of_failure, prob_of_failure[pauli]);
+        }
+
+        // Pick one with lowest failure probability
+        int the_best_pauli = 0;
+        for(int pauli = 0; pauli < 3; pauli ++){
+            if(smallest_prob_of_failure == prob_of_failure[pauli]){
+                the_best_pauli = pauli;
+                break;
+            }
+        }
+
+        entry = 0;
+        for(int pauli = 0; pauli <= 2; pauli ++){
+            for(; entry < (int)(acting_lists_end[pauli] - acting_entries); entry++){
+                int i = acting_entries[entry];
+                if(the_best_pauli == pauli){
+                    if(how_many_pauli_to_match[i] != INF){
+                        how_many_pauli_to_match[i] -= 1;
+                        current_scaled_log[i] = scaled_log_value(cur_num_of_measurements[i], how_many_pauli_to_match[i], observable_set.weight[i]);
+                        // The cached estimate of the next step is reused unless the observable
+                        // acts on ith_qubit more than once (then it was computed for the first match only)
+                        if(current_scaled_log[i] == matched_scaled_log[entry])
+                            current_fail_prob[i] = matched_fail_prob[entry];
+                        else{
+                            current_fail_prob[i] = fail_prob_pessimistic(current_scaled_log[i], shift);
+                            number_of_exp_calls ++;
+                        }
+                    }
+                }
+                else{
+                    how_many_pauli_to_match[i] = INF;
+                    current_scaled_log[i] = unmatched_scaled_log[i];
+                    current_fail_prob[i] = unmatched_fail_prob[i];
+                }
+            }
+        }
+
+        return the_best_pauli;
+    }
+
+    //
+    // The following function ends a measurement repetition: the matched observables are measured once more.
+    // The observables that become satisfied are removed from the active lists,
+    // and the function returns how many observables in the file they stand for.
+    //
+    int end_measurement_repetition(){
+        int newly_satisfied = 0;
+        for(int i : active_observables){
+            if(how_many_pauli_to_match[i] == 0){
+                cur_num_of_measurements[i] ++;
+                if(is_satisfied(i)) newly_satisfied += observable_set.multiplicity[i];
+            }
+        }
+        if(newly_satisfied > 0) remove_satisfied_observables();
+        return newly_satisfied;
+    }
+
+    //
+    // The following function drops the satisfied observables from the active lists, keeping the order of the remaining ones.
+    //
+    void remove_satisfied_observables(){
+        auto is_satisfied_observable = [this](int i){ return is_satisfied(i); };
+        active_observables.erase(std::remove_if(active_observables.begin(), active_observables.end(), is_satisfied_observable), active_observables.end());
+        observable_set.remove_from_index(is_satisfied_observable);
+    }
+};
+
+#endif
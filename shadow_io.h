@@ -0,0 +1,559 @@
+//
+// This code is created by Hsin-Yuan Huang (https://momohuang.github.io/).
+// For more details, see the accompany paper:
+//  "Predicting Many Properties of a Quantum System from Very Few Measurements".
+//
+// The following tokenizer is shared by data_acquisition_shadow.cpp and prediction_shadow.cpp
+// to read the measurement, observable, and subsystem files.
+// A regular file is memory-mapped and parsed in place without any per-line allocation;
+// other inputs (e.g., a pipe) are read into a single buffer first.
+// This file also defines the binary measurement format (.shadow),
+// and the exception shadow_error thrown by the library on invalid input.
+//
+#ifndef SHADOW_IO_H
+#define SHADOW_IO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <climits>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <string>
+#include <stdexcept>
+
+//
+// Invalid input is reported by throwing shadow_error with a message (e.g., the file name and the line number),
+// so that a program embedding the library can recover; the command line programs print it and stop.
+//
+class shadow_error : public std::runtime_error{
+public:
+    explicit shadow_error(const std::string& message): std::runtime_error(message){}
+};
+
+__attribute__((noreturn, format(printf, 1, 2)))
+inline void throw_shadow_error(const char* format, ...){
+    char message[1024];
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(message, sizeof(message), format, arguments);
+    va_end(arguments);
+    throw shadow_error(message);
+}
+
+class shadow_text_file{
+public:
+    shadow_text_file(): line_number(0), mapped_data(NULL), mapped_size(0), passed_end(false){}
+
+    //
+    // The following function opens the file: file_name
+    // and throws shadow_error if the file cannot be read.
+    //
+    void open(const char* file_name){
+        close();
+        this->file_name = file_name;
+        line_number = 0;
+        started_line = false;
+        passed_end = false;
+
+        int file_descriptor = ::open(file_name, O_RDONLY);
+        if(file_descriptor < 0){
+            throw_shadow_error("the input file \"%s\" does not exist.", file_name);
+        }
+
+        struct stat file_status;
+        if(fstat(file_descriptor, &file_status) == 0 && S_ISREG(file_status.st_mode) && file_status.st_size > 0){
+            mapped_size = (size_t)file_status.st_size;
+            void* mapped = mmap(NULL, mapped_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+            if(mapped != MAP_FAILED){
+                madvise(mapped, mapped_size, MADV_SEQUENTIAL);
+                mapped_data = (const char*)mapped;
+                cursor = mapped_data;
+                end = mapped_data + mapped_size;
+            }
+            else mapped_size = 0;
+        }
+        if(mapped_data == NULL){
+            char block[1 << 16];
+            ssize_t block_size;
+            while((block_size = read(file_descriptor, block, sizeof(block))) > 0)
+                buffer.insert(buffer.end(), block, block + block_size);
+            cursor = buffer.empty()? NULL: &buffer[0];
+            end = cursor + buffer.size();
+        }
+        ::close(file_descriptor);
+    }
+
+    //
+    // The following function parses the complete lines from begin to end-1 owned by the caller,
+    // continuing the line numbers of the previous lines.
+    //
+    void assign(const char* file_name, const char* begin, const char* end){
+        close();
+        this->file_name = file_name;
+        if(passed_end) line_number --; // the last call of next_line counted a line that was not there
+        passed_end = false;
+        started_line = false;
+        cursor = begin;
+        this->end = end;
+    }
+
+    void close(){
+        if(mapped_data != NULL) munmap((void*)mapped_data, mapped_size);
+        mapped_data = NULL;
+        std::vector<char>().swap(buffer);
+    }
+
+    ~shadow_text_file(){
+        close();
+    }
+
+    //
+    // An upper bound on the number of remaining lines, which is used to reserve memory.
+    //
+    long long count_remaining_lines(){
+        long long number_of_lines = 1;
+        for(const char* c = cursor; c < end; c++){
+            c = (const char*)memchr(c, '\n', end - c);
+            if(c == NULL) break;
+            number_of_lines ++;
+        }
+        return number_of_lines;
+    }
+
+    //
+    // The following function moves to the first token of the next non-empty line.
+    // It returns false when the end of the file is reached.
+    //
+    bool next_line(){
+        if(started_line) skip_line();
+        started_line = true;
+        while(true){
+            line_number ++;
+            skip_spaces();
+            if(cursor == end){
+                passed_end = true;
+                return false;
+            }
+            if(*cursor != '\n') return true;
+            cursor ++;
+        }
+    }
+
+    //
+    // The following function returns true if there is no token left on the current line.
+    //
+    bool end_of_line(){
+        skip_spaces();
+        return cursor == end || *cursor == '\n';
+    }
+
+    int read_int(const char* what){
+        skip_spaces();
+        const char* start = cursor;
+        bool negative = false;
+        if(cursor < end && (*cursor == '-' || *cursor == '+')){
+            negative = (*cursor == '-');
+            cursor ++;
+        }
+        long long value = 0;
+        const char* first_digit = cursor;
+        while(cursor < end && *cursor >= '0' && *cursor <= '9' && value <= 2147483647LL){
+            value = value * 10 + (*cursor - '0');
+            cursor ++;
+        }
+        if(cursor == first_digit || value > 2147483647LL || !at_token_boundary()){
+            cursor = start;
+            report_malformed(what);
+        }
+        return (int)(negative? -value: value);
+    }
+
+    //
+    // The following function reads the position of a qubit in a system of system_size qubits.
+    //
+    int read_position(int system_size){
+        int position = read_int("the position of a qubit");
+        if(position < 0 || position >= system_size)
+            report_malformed("the position of a qubit from 0 to [system size] - 1");
+        return position;
+    }
+
+    //
+    // The following function reads a single-qubit Pauli operator: X -> 0, Y -> 1, Z -> 2
+    //
+    int read_pauli(const char* what){
+        skip_spaces();
+        if(cursor == end || (*cursor != 'X' && *cursor != 'Y' && *cursor != 'Z'))
+            report_malformed(what);
+        int pauli_encoding = *cursor - 'X';
+        cursor ++;
+        if(!at_token_boundary())
+            report_malformed(what);
+        return pauli_encoding;
+    }
+
+    double read_double(const char* what){
+        skip_spaces();
+        char token[64];
+        int length = 0;
+        while(cursor + length < end && !is_separator(cursor[length]) && length < 63){
+            token[length] = cursor[length];
+            length ++;
+        }
+        token[length] = '\0';
+
+        char* token_end;
+        double value = strtod(token, &token_end);
+        if(length == 0 || token_end != token + length)
+            report_malformed(what);
+        cursor += length;
+        return value;
+    }
+
+    //
+    // The following function moves past the next token and returns true if it is [keyword],
+    // and otherwise returns false without moving.
+    //
+    bool read_keyword(const char* keyword){
+        skip_spaces();
+        size_t length = strlen(keyword);
+        if((size_t)(end - cursor) < length || memcmp(cursor, keyword, length) != 0) return false;
+        const char* start = cursor;
+        cursor += length;
+        if(!at_token_boundary()){
+            cursor = start;
+            return false;
+        }
+        return true;
+    }
+
+    //
+    // The following function returns the next token of the current line ("" at the end of the line) without moving past it.
+    //
+    std::string peek_token(){
+        skip_spaces();
+        const char* token_end = cursor;
+        while(token_end < end && !is_separator(*token_end)) token_end ++;
+        return std::string(cursor, token_end);
+    }
+
+    std::string read_token(const char* what){
+        std::string token = peek_token();
+        if(token.empty()) report_malformed(what);
+        cursor += token.size();
+        return token;
+    }
+
+    //
+    // The following function throws shadow_error with the file name and the current line number.
+    //
+    void report_malformed(const char* what){
+        throw_shadow_error("expected %s on line %d of the input file \"%s\".", what, line_number, file_name);
+    }
+
+    int line_number;
+
+private:
+    const char* file_name;
+    const char* mapped_data;
+    size_t mapped_size;
+    std::vector<char> buffer;
+    const char* cursor;
+    const char* end;
+    bool started_line, passed_end;
+
+    static bool is_separator(char c){
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+    bool at_token_boundary(){
+        return cursor == end || is_separator(*cursor);
+    }
+    void skip_spaces(){
+        while(cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')) cursor ++;
+    }
+    void skip_line(){
+        const char* newline = (cursor == end)? NULL: (const char*)memchr(cursor, '\n', end - cursor);
+        cursor = (newline == NULL)? end: newline + 1;
+    }
+};
+
+//
+// The following class reads a text stream (e.g., stdin or a FIFO) while it is being written.
+// The data is received into a buffer that only holds the lines not yet parsed,
+// so the memory does not grow with the length of the stream.
+//
+class shadow_text_stream{
+public:
+    shadow_text_stream(): file_descriptor(-1){}
+    ~shadow_text_stream(){
+        if(file_descriptor > 0) ::close(file_descriptor);
+    }
+
+    //
+    // The following function opens the stream: file_name ("-" stands for stdin)
+    //
+    void open(const char* file_name){
+        this->file_name = file_name;
+        file_descriptor = (strcmp(file_name, "-") == 0)? 0: ::open(file_name, O_RDONLY);
+        if(file_descriptor < 0){
+            throw_shadow_error("the input file \"%s\" does not exist.", file_name);
+        }
+        buffer.resize(1 << 20);
+        filled = 0;
+        handed_out = 0;
+        end_of_stream = false;
+    }
+
+    //
+    // The following function waits at most timeout_in_seconds (forever if negative) for more data,
+    // and lets [lines] parse all the complete lines received so far.
+    // It returns false once the stream has ended and every line has been handed out.
+    //
+    bool receive(double timeout_in_seconds, shadow_text_file& lines){
+        // Drop the lines handed out before, and keep the unfinished line
+        memmove(&buffer[0], &buffer[handed_out], filled - handed_out);
+        filled -= handed_out;
+        handed_out = 0;
+        if(filled == buffer.size()) buffer.resize(2 * buffer.size());
+
+        if(!end_of_stream){
+            struct pollfd stream_poll;
+            stream_poll.fd = file_descriptor;
+            stream_poll.events = POLLIN;
+            int timeout_in_milliseconds = (timeout_in_seconds < 0)? -1: (int)(timeout_in_seconds * 1000);
+            if(poll(&stream_poll, 1, timeout_in_milliseconds) > 0){
+                ssize_t received = read(file_descriptor, &buffer[filled], buffer.size() - filled);
+                if(received > 0) filled += received;
+                else if(received == 0 || errno != EINTR) end_of_stream = true;
+            }
+        }
+
+        // Hand out everything up to the last newline (or everything at the end of the stream)
+        size_t complete = filled;
+        if(!end_of_stream){
+            while(complete > 0 && buffer[complete - 1] != '\n') complete --;
+        }
+        handed_out = complete;
+        lines.assign(file_name, &buffer[0], &buffer[0] + complete);
+        return !(end_of_stream && complete == 0);
+    }
+
+private:
+    const char* file_name;
+    int file_descriptor;
+    std::vector<char> buffer;
+    size_t filled, handed_out;
+    bool end_of_stream;
+};
+
+//
+// The binary measurement format (.shadow) stores the bit-packed measurement data
+// used by prediction_shadow.cpp, so that it does not need to be parsed again:
+//   a header of 64 bytes (shadow_file_header),
+//   followed by [number_of_shots] shots, each consisting of [planes_per_shot] planes
+//   of [words_per_plane] 64-bit words.
+// The planes are: the low bit of the Pauli basis, the high bit of the Pauli basis,
+// and (if planes_per_shot == 3) the bit of the -1 outcomes.
+// Since every shot has the same size, any range of shots can be mapped on its own.
+//
+const char SHADOW_FILE_MAGIC[8] = {'S', 'H', 'A', 'D', 'O', 'W', '\n', '\0'};
+const unsigned int SHADOW_FILE_VERSION = 1;
+const unsigned int SHADOW_FILE_BYTE_ORDER = 0x01020304;
+
+struct shadow_file_header{
+    char magic[8];
+    unsigned int version;
+    unsigned int byte_order; // SHADOW_FILE_BYTE_ORDER as written by the machine that created the file
+    unsigned int system_size;
+    unsigned int words_per_plane;
+    unsigned int planes_per_shot;
+    unsigned int reserved_flags;
+    unsigned long long number_of_shots;
+    char reserved[24];
+};
+static_assert(sizeof(shadow_file_header) == 64, "the header of a .shadow file has 64 bytes");
+
+//
+// The following function returns true if file_name starts with the header of a .shadow file.
+//
+inline bool is_shadow_file(const char* file_name){
+    char magic[sizeof(SHADOW_FILE_MAGIC)];
+    FILE* file = fopen(file_name, "rb");
+    if(file == NULL) return false;
+    bool has_magic = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, SHADOW_FILE_MAGIC, sizeof(magic)) == 0;
+    fclose(file);
+    return has_magic;
+}
+
+//
+// The following class writes a .shadow file in pieces:
+// open() writes the header, write() appends whole shots, and close() fills in the number of shots in the header.
+//
+class shadow_binary_writer{
+public:
+    shadow_binary_writer(): file(NULL){}
+    ~shadow_binary_writer(){
+        if(file != NULL) fclose(file);
+    }
+
+    void open(const char* file_name, int system_size, int planes_per_shot){
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SHADOW_FILE_MAGIC, sizeof(SHADOW_FILE_MAGIC));
+        header.version = SHADOW_FILE_VERSION;
+        header.byte_order = SHADOW_FILE_BYTE_ORDER;
+        header.system_size = system_size;
+        header.words_per_plane = (system_size + 63) / 64;
+        header.planes_per_shot = planes_per_shot;
+        header.number_of_shots = 0;
+
+        this->file_name = file_name;
+        file = fopen(file_name, "wb");
+        if(file == NULL){
+            throw_shadow_error("the output file \"%s\" cannot be created.", file_name);
+        }
+        if(fwrite(&header, sizeof(header), 1, file) != 1) fail();
+    }
+
+    void write(const unsigned long long* shots, long long number_of_shots){
+        size_t number_of_words = (size_t)number_of_shots * header.planes_per_shot * header.words_per_plane;
+        if(fwrite(shots, sizeof(unsigned long long), number_of_words, file) != number_of_words) fail();
+        header.number_of_shots += number_of_shots;
+    }
+
+    void close(){
+        if(fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1) fail();
+        FILE* closing_file = file;
+        file = NULL;
+        if(fclose(closing_file) != 0){
+            throw_shadow_error("failed to write the output file \"%s\".", file_name.c_str());
+        }
+    }
+
+private:
+    shadow_file_header header;
+    std::string file_name;
+    FILE* file;
+
+    __attribute__((noreturn)) void fail(){
+        fclose(file);
+        file = NULL;
+        throw_shadow_error("failed to write the output file \"%s\".", file_name.c_str());
+    }
+};
+
+//
+// The following function writes number_of_shots shots stored in data to the file: file_name
+//
+inline void write_shadow_file(const char* file_name, int system_size, int planes_per_shot, long long number_of_shots, const unsigned long long* data){
+    shadow_binary_writer writer;
+    writer.open(file_name, system_size, planes_per_shot);
+    writer.write(data, number_of_shots);
+    writer.close();
+}
+
+//
+// The following class memory-maps the shots from first_shot to last_shot-1 of a .shadow file.
+// The mapped shots stay valid until the object is closed or destroyed.
+//
+class shadow_binary_file{
+public:
+    shadow_binary_file(): mapped_data(NULL), mapped_size(0), shot_data(NULL), number_of_shots(0){}
+    ~shadow_binary_file(){
+        close();
+    }
+
+    void open(const char* file_name, long long first_shot, long long last_shot){
+        close();
+        int file_descriptor = ::open(file_name, O_RDONLY);
+        if(file_descriptor < 0){
+            throw_shadow_error("the input file \"%s\" does not exist.", file_name);
+        }
+
+        struct stat file_status;
+        if(fstat(file_descriptor, &file_status) != 0 || pread(file_descriptor, &header, sizeof(header), 0) != (ssize_t)sizeof(header)
+           || memcmp(header.magic, SHADOW_FILE_MAGIC, sizeof(SHADOW_FILE_MAGIC)) != 0){
+            ::close(file_descriptor);
+            throw_shadow_error("the input file \"%s\" is not a .shadow file.", file_name);
+        }
+        if(header.version != SHADOW_FILE_VERSION || header.byte_order != SHADOW_FILE_BYTE_ORDER){
+            ::close(file_descriptor);
+            throw_shadow_error("the .shadow file \"%s\" has version %u, or was written on a machine with a different byte order.", file_name, header.version);
+        }
+
+        // The number of shots is checked by a division, since a corrupted count could overflow the size of the shots
+        size_t shot_size = (size_t)header.planes_per_shot * header.words_per_plane * sizeof(unsigned long long);
+        if(header.system_size > INT_MAX || header.words_per_plane != (header.system_size + 63) / 64
+           || (header.planes_per_shot != 2 && header.planes_per_shot != 3)
+           || (shot_size > 0 && header.number_of_shots > ((unsigned long long)file_status.st_size - sizeof(header)) / shot_size)){
+            ::close(file_descriptor);
+            throw_shadow_error("the .shadow file \"%s\" is truncated or corrupted.", file_name);
+        }
+
+        // Map the requested range of shots, starting from a page boundary
+        last_shot = std::min(last_shot, (long long)header.number_of_shots);
+        first_shot = std::min(first_shot, last_shot);
+        number_of_shots = last_shot - first_shot;
+        size_t range_begin = sizeof(header) + (size_t)first_shot * shot_size;
+        size_t range_end = sizeof(header) + (size_t)last_shot * shot_size;
+        size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+        size_t map_begin = range_begin / page_size * page_size;
+
+        mapped_size = range_end - map_begin;
+        if(mapped_size > 0){
+            void* mapped = mmap(NULL, mapped_size, PROT_READ, MAP_PRIVATE, file_descriptor, (off_t)map_begin);
+            if(mapped == MAP_FAILED){
+                ::close(file_descriptor);
+                throw_shadow_error("the .shadow file \"%s\" cannot be memory-mapped.", file_name);
+            }
+            mapped_data = (const char*)mapped;
+            shot_data = (const unsigned long long*)(mapped_data + (range_begin - map_begin));
+        }
+        ::close(file_descriptor);
+    }
+
+    void close(){
+        if(mapped_data != NULL) munmap((void*)mapped_data, mapped_size);
+        mapped_data = NULL;
+        shot_data = NULL;
+        number_of_shots = 0;
+    }
+
+    shadow_file_header header;
+
+    const unsigned long long* shots() const{
+        return shot_data;
+    }
+    long long size() const{
+        return number_of_shots;
+    }
+
+    //
+    // The following function tells the kernel that the shots from first_shot to last_shot-1 are not needed any more,
+    // so that their pages leave the memory of the process (they are read from the file again if they are used later).
+    //
+    void release_shots(long long first_shot, long long last_shot){
+        size_t shot_size = (size_t)header.planes_per_shot * header.words_per_plane * sizeof(unsigned long long);
+        size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+        size_t range_begin = (size_t)((const char*)shot_data - mapped_data) + (size_t)first_shot * shot_size;
+        size_t range_end = (size_t)((const char*)shot_data - mapped_data) + (size_t)last_shot * shot_size;
+        range_begin = range_begin / page_size * page_size;
+        range_end = range_end / page_size * page_size;
+        if(range_begin < range_end) madvise((void*)(mapped_data + range_begin), range_end - range_begin, MADV_DONTNEED);
+    }
+
+private:
+    const char* mapped_data;
+    size_t mapped_size;
+    const unsigned long long* shot_data;
+    long long number_of_shots;
+};
+
+#endif
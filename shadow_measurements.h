@@ -0,0 +1,294 @@
+//
+// This code is created by Hsin-Yuan Huang (https://momohuang.github.io/).
+// For more details, see the accompany paper:
+//  "Predicting Many Properties of a Quantum System from Very Few Measurements".
+//
+// The following measurement set holds the single-shot Pauli measurements used by prediction_shadow.cpp.
+// The measurement data is stored in a bit-packed form.
+// Every single-shot measurement occupies three planes of [words_per_plane] 64-bit words:
+//   plane 0 stores the low bit of the Pauli basis,
+//   plane 1 stores the high bit of the Pauli basis,
+//   plane 2 stores the binary outcome (bit set for -1, cleared for 1).
+// The two basis bits follow the encoding pauli[0] - 'X' (X -> 0, Y -> 1, Z -> 2).
+// The three planes of a single shot are adjacent in [data],
+// so a whole shot sits in a few consecutive cache lines.
+// This is also the layout of the shots in a .shadow file.
+//
+// [data] points to [bits] when the measurements are parsed from text,
+// to the memory-mapped [binary_file] when they are read from a .shadow file,
+// and to the caller's memory when they are borrowed (which is never copied).
+//
+#ifndef SHADOW_MEASUREMENTS_H
+#define SHADOW_MEASUREMENTS_H
+
+#include <climits>
+#include <vector>
+#include <algorithm>
+#include "shadow_io.h"
+
+class shadow_measurement_set{
+public:
+    int system_size;
+    int words_per_plane;
+    int number_of_shots;
+    const unsigned long long* data;
+
+    shadow_measurement_set(): system_size(-1), words_per_plane(0), number_of_shots(0), data(NULL){}
+    shadow_measurement_set(const shadow_measurement_set&) = delete;
+    shadow_measurement_set& operator=(const shadow_measurement_set&) = delete;
+
+    inline const unsigned long long* shot(int t) const{
+        return data + (size_t)t * 3 * words_per_plane;
+    }
+    inline int pauli_basis(int t, int ith_qubit) const{
+        const unsigned long long* shot_t = shot(t);
+        int word = ith_qubit >> 6, bit = ith_qubit & 63;
+        return (int)((shot_t[word] >> bit) & 1) | ((int)((shot_t[words_per_plane + word] >> bit) & 1) << 1);
+    }
+    inline int binary_outcome(int t, int ith_qubit) const{
+        const unsigned long long* shot_t = shot(t);
+        int word = ith_qubit >> 6, bit = ith_qubit & 63;
+        return 1 - 2 * (int)((shot_t[2 * words_per_plane + word] >> bit) & 1);
+    }
+
+    //
+    // The following function reads the measurements from either a text file or a .shadow file.
+    // If system_size is -1, the system size is taken from the file.
+    // Only the shots from first_shot to last_shot-1 (counting from 0) are read.
+    //
+    void read(const char* measurement_file_name, int system_size = -1, int first_shot = 0, int last_shot = INT_MAX){
+        if(is_shadow_file(measurement_file_name))
+            read_binary(measurement_file_name, system_size, first_shot, last_shot);
+        else{
+            shadow_text_file measurement_file;
+            measurement_file.open(measurement_file_name);
+            read_text(measurement_file, system_size, first_shot, last_shot);
+        }
+    }
+
+    //
+    // The following function parses the measurements from the text from text to text+length-1 in memory,
+    // which has the same format as the measurement file.
+    //
+    void parse(const char* text, size_t length, int system_size = -1, int first_shot = 0, int last_shot = INT_MAX){
+        shadow_text_file measurement_file;
+        measurement_file.assign("(measurements in memory)", text, text + length);
+        read_text(measurement_file, system_size, first_shot, last_shot);
+    }
+
+    //
+    // The following function reads a measurement scheme (from the current line of scheme_file on):
+    // one line of system_size Pauli bases X/Y/Z for every measurement, as printed by data_acquisition_shadow.
+    // The outcomes are set to 1, so every shot simply counts the observables it measures.
+    // A .shadow file of measurement bases (two planes per shot, as written by data_acquisition_shadow -r) is read as well.
+    //
+    void read_scheme(const char* scheme_file_name, int system_size){
+        if(is_shadow_file(scheme_file_name)){
+            read_binary_scheme(scheme_file_name, system_size);
+            return;
+        }
+        shadow_text_file scheme_file;
+        scheme_file.open(scheme_file_name);
+        read_scheme(scheme_file, system_size);
+    }
+
+    void read_scheme(shadow_text_file& scheme_file, int system_size){
+        release();
+        set_system_size(system_size);
+        bits.assign((size_t)scheme_file.count_remaining_lines() * 3 * words_per_plane, 0);
+
+        int measurement_counter = 0;
+        while(scheme_file.next_line()){
+            unsigned long long* shot = &bits[(size_t)measurement_counter * 3 * words_per_plane];
+            for(int ith_qubit = 0; ith_qubit < system_size; ith_qubit++){
+                int pauli_encoding = scheme_file.read_pauli("a measurement basis X/Y/Z");
+                int word = ith_qubit >> 6, bit = ith_qubit & 63;
+                shot[word] |= (unsigned long long)(pauli_encoding & 1) << bit;
+                shot[words_per_plane + word] |= (unsigned long long)(pauli_encoding >> 1) << bit;
+            }
+            if(!scheme_file.end_of_line())
+                scheme_file.report_malformed("exactly [system size] measurement bases");
+            measurement_counter ++;
+        }
+        number_of_shots = measurement_counter;
+        bits.resize((size_t)number_of_shots * 3 * words_per_plane);
+
+        data = bits.data();
+    }
+
+    //
+    // The following function returns the first of the count packed shots (of planes_per_shot planes) in which a qubit
+    // has both bits of its basis set, which no Pauli basis is encoded as (X -> 0, Y -> 1, Z -> 2), or -1 if there is none.
+    // Only a corrupted .shadow file or the packed shots of a caller can hold it, and it costs one AND per word.
+    //
+    long long find_invalid_basis(const unsigned long long* shots, long long count, int planes_per_shot) const{
+        for(long long t = 0; t < count; t++){
+            const unsigned long long* shot = shots + (size_t)t * planes_per_shot * words_per_plane;
+            unsigned long long invalid_bases = 0;
+            for(int w = 0; w < words_per_plane; w++) invalid_bases |= shot[w] & shot[words_per_plane + w];
+            if(invalid_bases != 0) return t;
+        }
+        return -1;
+    }
+
+    //
+    // The following function uses number_of_shots packed shots owned by the caller (in the layout above)
+    // without copying them; they must stay valid while the measurement set is used.
+    //
+    void borrow(int system_size, int number_of_shots, const unsigned long long* packed_shots){
+        release();
+        set_system_size(system_size);
+        this->number_of_shots = number_of_shots;
+        data = packed_shots;
+    }
+
+    //
+    // The following functions collect a stream of measurements in batches of batch_size shots:
+    // append_line parses one line of the stream into the next shot of the batch,
+    // append_shots returns the (cleared) memory of the next count shots of the batch for packed shots,
+    // and clear_shots empties the batch once it has been used.
+    //
+    void start_batches(int system_size, int batch_size){
+        release();
+        set_system_size(system_size);
+        bits.assign((size_t)batch_size * 3 * words_per_plane, 0);
+        data = bits.data();
+    }
+    void append_line(shadow_text_file& measurement_file){
+        parse_line(measurement_file, &bits[(size_t)number_of_shots * 3 * words_per_plane]);
+        number_of_shots ++;
+    }
+    unsigned long long* append_shots(int count){
+        unsigned long long* shots = &bits[(size_t)number_of_shots * 3 * words_per_plane];
+        number_of_shots += count;
+        return shots;
+    }
+    int batch_size() const{
+        return (int)(bits.size() / (3 * words_per_plane));
+    }
+    void clear_shots(){
+        std::fill(bits.begin(), bits.begin() + (size_t)number_of_shots * 3 * words_per_plane, 0ULL);
+        number_of_shots = 0;
+    }
+
+    void release(){
+        std::vector<unsigned long long>().swap(bits);
+        binary_file.close();
+        number_of_shots = 0;
+        data = NULL;
+    }
+
+private:
+    std::vector<unsigned long long> bits;
+    shadow_binary_file binary_file;
+
+    void set_system_size(int system_size){
+        this->system_size = system_size;
+        words_per_plane = (system_size + 63) / 64;
+    }
+
+    //
+    // The following function parses one line of a measurement file into a packed [shot]
+    // which has been cleared to zero.
+    //
+    void parse_line(shadow_text_file& measurement_file, unsigned long long* shot){
+        for(int ith_qubit = 0; ith_qubit < system_size; ith_qubit++){
+            int pauli_encoding = measurement_file.read_pauli("a measurement basis X/Y/Z");
+            int binary_outcome = measurement_file.read_int("a binary outcome 1/-1");
+            if(binary_outcome != 1 && binary_outcome != -1)
+                measurement_file.report_malformed("a binary outcome 1/-1");
+
+            int word = ith_qubit >> 6, bit = ith_qubit & 63;
+            shot[word] |= (unsigned long long)(pauli_encoding & 1) << bit;
+            shot[words_per_plane + word] |= (unsigned long long)(pauli_encoding >> 1) << bit;
+            shot[2 * words_per_plane + word] |= (unsigned long long)(binary_outcome == -1) << bit;
+        }
+    }
+
+    //
+    // The following function reads the text: measurement_file
+    // and updates [bits] and [number_of_shots]
+    //
+    void read_text(shadow_text_file& measurement_file, int system_size, int first_shot, int last_shot){
+        release();
+
+        // Read in the system size
+        if(!measurement_file.next_line()) measurement_file.report_malformed("the system size");
+        int system_size_measurement = measurement_file.read_int("the system size");
+        if(system_size == -1) system_size = system_size_measurement;
+        if(system_size_measurement != system_size)
+            throw_shadow_error("the system size do not match.");
+        set_system_size(system_size);
+
+        // Every line holds at most one shot
+        long long number_of_lines = std::min(measurement_file.count_remaining_lines(), (long long)last_shot - first_shot);
+        bits.assign((size_t)number_of_lines * 3 * words_per_plane, 0);
+
+        // Read in the measurements line by line
+        int shot_in_file = 0, measurement_counter = 0;
+        while(shot_in_file < last_shot && measurement_file.next_line()){
+            if(shot_in_file++ < first_shot) continue;
+
+            parse_line(measurement_file, &bits[(size_t)measurement_counter * 3 * words_per_plane]);
+            measurement_counter ++;
+        }
+        number_of_shots = measurement_counter;
+        bits.resize((size_t)number_of_shots * 3 * words_per_plane);
+
+        data = bits.data();
+    }
+
+    //
+    // The following function memory-maps the .shadow file: measurement_file_name
+    // and updates [binary_file] and [number_of_shots]
+    //
+    void read_binary(const char* measurement_file_name, int system_size, int first_shot, int last_shot){
+        release();
+        binary_file.open(measurement_file_name, first_shot, last_shot);
+
+        int system_size_measurement = (int)binary_file.header.system_size;
+        if(system_size == -1) system_size = system_size_measurement;
+        if(system_size_measurement != system_size)
+            throw_shadow_error("the system size do not match.");
+        if(binary_file.header.planes_per_shot != 3)
+            throw_shadow_error("the .shadow file \"%s\" contains measurement bases without outcomes.", measurement_file_name);
+        if(binary_file.size() > INT_MAX)
+            throw_shadow_error("the .shadow file \"%s\" holds more than %d shots.", measurement_file_name, INT_MAX);
+        set_system_size(system_size);
+
+        long long invalid_shot = find_invalid_basis(binary_file.shots(), binary_file.size(), 3);
+        if(invalid_shot >= 0)
+            throw_shadow_error("the %lld-th shot of the .shadow file \"%s\" has a qubit without a Pauli basis.", first_shot + invalid_shot + 1, measurement_file_name);
+
+        number_of_shots = (int)binary_file.size();
+        data = binary_file.shots();
+    }
+
+    //
+    // The following function copies the bases of the .shadow file: scheme_file_name into [bits] with all outcomes set to 1.
+    //
+    void read_binary_scheme(const char* scheme_file_name, int system_size){
+        release();
+        shadow_binary_file scheme_file;
+        scheme_file.open(scheme_file_name, 0, LLONG_MAX);
+        if((int)scheme_file.header.system_size != system_size)
+            throw_shadow_error("the system size do not match.");
+        set_system_size(system_size);
+
+        int planes_per_shot = (int)scheme_file.header.planes_per_shot; // 2 or 3, checked by shadow_binary_file
+        if(scheme_file.size() > INT_MAX)
+            throw_shadow_error("the .shadow file \"%s\" holds more than %d shots.", scheme_file_name, INT_MAX);
+        long long invalid_shot = find_invalid_basis(scheme_file.shots(), scheme_file.size(), planes_per_shot);
+        if(invalid_shot >= 0)
+            throw_shadow_error("the %lld-th shot of the .shadow file \"%s\" has a qubit without a Pauli basis.", invalid_shot + 1, scheme_file_name);
+        number_of_shots = (int)scheme_file.size();
+        bits.assign((size_t)number_of_shots * 3 * words_per_plane, 0);
+        for(int t = 0; t < number_of_shots; t++){
+            const unsigned long long* shot_in_file = scheme_file.shots() + (size_t)t * planes_per_shot * words_per_plane;
+            std::copy(shot_in_file, shot_in_file + 2 * words_per_plane, &bits[(size_t)t * 3 * words_per_plane]);
+        }
+        data = bits.data();
+    }
+};
+
+#endif
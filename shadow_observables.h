@@ -0,0 +1,440 @@
+//
+// This code is created by Hsin-Yuan Huang (https://momohuang.github.io/).
+// For more details, see the accompany paper:
+//  "Predicting Many Properties of a Quantum System from Very Few Measurements".
+//
+// The following observable set is shared by data_acquisition_shadow.cpp and prediction_shadow.cpp,
+// together with the set of subsystems for the entanglement entropy.
+// The observables are canonicalized (the Pauli operators are sorted by qubit) and hashed,
+// so that identical Pauli strings are stored and evaluated only once,
+// and the results are fanned back out to the original observables.
+// The inverted index from (qubit, Pauli) to observables is stored in flat CSR arrays.
+// A single line of the observable file may also describe a whole family of observables (see pauli_observable_family).
+//
+#ifndef SHADOW_OBSERVABLES_H
+#define SHADOW_OBSERVABLES_H
+
+#include <string.h>
+#include <climits>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include "shadow_io.h"
+#include "shadow_profile.h"
+
+//
+// The following family describes many observables with a single line of the observable file,
+// so that they are added to the observable set without being written out:
+//   each|increasing [block 1] [block 2] ... [within [span]]
+// Every block is a word over X, Y, Z, and * (any of X, Y, Z) placed on consecutive qubits, e.g.
+//   "each XX Z" is XX on the qubits (i, i+1) times Z on any other qubit j,
+//   "increasing * *" is every two-point correlator P_i Q_j with i < j,
+//   "increasing * * * within 5" is every 3-local Pauli string on a window of 5 consecutive qubits.
+// "each" places the blocks on non-overlapping qubits in every order (nested loops over the positions of the blocks),
+// "increasing" only places every block after the end of the previous block,
+// and "within [span]" only keeps the placements whose blocks cover at most [span] consecutive qubits.
+//
+class pauli_observable_family{
+public:
+    bool is_increasing;
+    std::vector<std::string> blocks;
+    int span;
+
+    //
+    // The following function reads the family from the current line of observable_file,
+    // which starts with the keyword each or increasing, and stops before anything that follows the family (e.g., a weight).
+    //
+    void read(shadow_text_file& observable_file){
+        if(observable_file.read_keyword("increasing")) is_increasing = true;
+        else if(observable_file.read_keyword("each")) is_increasing = false;
+        else observable_file.report_malformed("each or increasing");
+
+        blocks.clear();
+        span = INT_MAX;
+        while(true){
+            std::string token = observable_file.peek_token();
+            if(token == "within"){
+                observable_file.read_token("within");
+                span = observable_file.read_int("the span of the family");
+                if(span <= 0) observable_file.report_malformed("a positive span of the family");
+            }
+            else if(!token.empty() && token.find_first_not_of("XYZ*") == std::string::npos)
+                blocks.push_back(observable_file.read_token("a block of Pauli operators"));
+            else break;
+        }
+        if(blocks.empty()) observable_file.report_malformed("a block of Pauli operators X/Y/Z/*");
+    }
+
+    //
+    // The following function calls observable(codes) for every observable of the family on a system of system_size qubits,
+    // where codes lists its Pauli operators as ith_qubit * 3 + pauli.
+    // The placements of the blocks are enumerated with the first block outermost,
+    // and the Pauli operators of the * of a placement in the order X, Y, Z with the first * outermost.
+    //
+    template<class observable_function>
+    void for_each(int system_size, observable_function observable) const{
+        std::vector<int> positions(blocks.size());
+        std::vector<char> occupied(system_size, 0);
+        std::vector<int> codes;
+        place_blocks(0, system_size, positions, occupied, codes, observable);
+    }
+
+private:
+    template<class observable_function>
+    void place_blocks(int b, int system_size, std::vector<int>& positions, std::vector<char>& occupied, std::vector<int>& codes, observable_function& observable) const{
+        if(b == (int)blocks.size()){
+            expand_wildcards(positions, codes, observable);
+            return;
+        }
+        int length = (int)blocks[b].size();
+        int first_position = (is_increasing && b > 0)? positions[b-1] + (int)blocks[b-1].size(): 0;
+        for(int position = first_position; position + length <= system_size; position++){
+            bool is_free = true;
+            for(int q = position; q < position + length && is_free; q++) is_free = !occupied[q];
+            if(!is_free || !within_span(b, position, positions)) continue;
+
+            positions[b] = position;
+            for(int q = position; q < position + length; q++) occupied[q] = 1;
+            place_blocks(b + 1, system_size, positions, occupied, codes, observable);
+            for(int q = position; q < position + length; q++) occupied[q] = 0;
+        }
+    }
+
+    bool within_span(int b, int position, const std::vector<int>& positions) const{
+        if(span == INT_MAX) return true;
+        int first_qubit = position, last_qubit = position + (int)blocks[b].size() - 1;
+        for(int c = 0; c < b; c++){
+            first_qubit = std::min(first_qubit, positions[c]);
+            last_qubit = std::max(last_qubit, positions[c] + (int)blocks[c].size() - 1);
+        }
+        return last_qubit - first_qubit + 1 <= span;
+    }
+
+    template<class observable_function>
+    void expand_wildcards(const std::vector<int>& positions, std::vector<int>& codes, observable_function& observable) const{
+        // The qubits of the * in the order of the blocks
+        std::vector<int> wildcard_qubits;
+        for(int b = 0; b < (int)blocks.size(); b++)
+            for(int c = 0; c < (int)blocks[b].size(); c++)
+                if(blocks[b][c] == '*') wildcard_qubits.push_back(positions[b] + c);
+
+        std::vector<int> wildcard_paulis(wildcard_qubits.size(), 0);
+        while(true){
+            codes.clear();
+            for(int b = 0; b < (int)blocks.size(); b++)
+                for(int c = 0; c < (int)blocks[b].size(); c++)
+                    if(blocks[b][c] != '*') codes.push_back((positions[b] + c) * 3 + (blocks[b][c] - 'X'));
+            for(int w = 0; w < (int)wildcard_qubits.size(); w++) codes.push_back(wildcard_qubits[w] * 3 + wildcard_paulis[w]);
+            observable(codes);
+
+            // Move to the next Pauli operators of the *, with the last * innermost
+            int w = (int)wildcard_paulis.size() - 1;
+            while(w >= 0 && wildcard_paulis[w] == 2) wildcard_paulis[w--] = 0;
+            if(w < 0) break;
+            wildcard_paulis[w] ++;
+        }
+    }
+};
+
+class pauli_observable_set{
+public:
+    int system_size;
+    int number_of_observables; // the number of observables in the file
+    int number_of_unique_observables;
+    int max_k_local;
+
+    // For every observable in the file, the index of its unique Pauli string
+    std::vector<int> unique_observable;
+
+    //
+    // For every unique observable u:
+    //   its Pauli operators are term_code[term_offset[u]] to term_code[term_offset[u+1]-1],
+    //   where term_code = ith_qubit * 3 + pauli (X -> 0, Y -> 1, Z -> 2),
+    //   its weight is weight[u], and it appears multiplicity[u] times in the file.
+    //
+    std::vector<int> term_offset, term_code;
+    std::vector<double> weight;
+    std::vector<int> multiplicity;
+
+    //
+    // The grammar of the inverted index:
+    //   acting_observables[acting_offset[ith_qubit * 3 + pauli]] to acting_observables[acting_offset[ith_qubit * 3 + pauli + 1] - 1]
+    //     are the unique observables that apply X (0), Y (1), Z (2) on the ith_qubit, in increasing order.
+    //
+    std::vector<int> acting_offset, acting_observables;
+
+    //
+    // The grammar of the support groups (only built by build_support_groups):
+    //   group_members[group_offset[g]] to group_members[group_offset[g+1] - 1]
+    //     are the unique observables acting on the same qubits, sorted by their Pauli operators,
+    //   and group_shared_terms[m] is the number of leading Pauli operators that group_members[m]
+    //     has in common with group_members[m-1] (0 for the first member of a group).
+    //
+    std::vector<int> group_offset, group_members, group_shared_terms;
+
+    int number_of_support_groups() const{
+        return group_offset.empty()? 0: (int)group_offset.size() - 1;
+    }
+
+    int k_local(int u) const{
+        return term_offset[u+1] - term_offset[u];
+    }
+    const int* acting_begin(int ith_qubit, int pauli) const{
+        return acting_observables.data() + acting_offset[ith_qubit * 3 + pauli];
+    }
+    const int* acting_end(int ith_qubit, int pauli) const{
+        return acting_observables.data() + acting_offset[ith_qubit * 3 + pauli + 1];
+    }
+
+    //
+    // The following function reads the file: observable_file_name.
+    // If system_size is -1, the system size is taken from the file.
+    // If read_weights is true, an optional [weight] at the end of every line is read,
+    // and two observables are only identical if they also have the same weight;
+    // otherwise anything after the Pauli operators is ignored.
+    //
+    void read(const char* observable_file_name, int system_size, bool read_weights){
+        shadow_text_file observable_file;
+        observable_file.open(observable_file_name);
+        read(observable_file, system_size, read_weights);
+    }
+
+    //
+    // The following function reads the observables from the text from text to text+length-1 in memory,
+    // which has the same format as the file.
+    //
+    void parse(const char* text, size_t length, int system_size, bool read_weights){
+        shadow_text_file observable_file;
+        observable_file.assign("(observables in memory)", text, text + length);
+        read(observable_file, system_size, read_weights);
+    }
+
+    void read(shadow_text_file& observable_file, int system_size, bool read_weights){
+        // Read in the system size
+        if(!observable_file.next_line()) observable_file.report_malformed("the system size");
+        int system_size_observable = observable_file.read_int("the system size");
+        this->system_size = (system_size == -1)? system_size_observable: system_size;
+
+        clear();
+
+        // Read in the local observables line by line
+        std::vector<int> codes;
+        pauli_observable_family family;
+        while(observable_file.next_line()){
+            // A line starting with each or increasing is a family of observables (see pauli_observable_family)
+            std::string keyword = observable_file.peek_token();
+            bool is_family = (keyword == "each" || keyword == "increasing");
+            if(is_family) family.read(observable_file);
+            else{
+                int k_local = observable_file.read_int("the number of Pauli operators [k-local]");
+
+                codes.clear();
+                for(int k = 0; k < k_local; k++){
+                    int pauli_encoding = observable_file.read_pauli("a Pauli operator X/Y/Z"); // X -> 0, Y -> 1, Z -> 2
+                    int position_of_pauli = observable_file.read_position(this->system_size);
+                    codes.push_back(position_of_pauli * 3 + pauli_encoding);
+                }
+            }
+
+            double observable_weight = 1.0;
+            if(read_weights && !observable_file.end_of_line())
+                observable_weight = observable_file.read_double("a weight for the observable");
+
+            if(is_family){
+                family.for_each(this->system_size, [this, observable_weight](std::vector<int>& family_codes){
+                    add(family_codes, observable_weight);
+                });
+                shadow_profile::instance().add_counter("observable families", 1);
+            }
+            else add(codes, observable_weight);
+        }
+
+        build_index();
+        std::unordered_multimap<unsigned long long, int>().swap(unique_of_hash);
+    }
+
+    void clear(){
+        number_of_observables = 0;
+        number_of_unique_observables = 0;
+        max_k_local = 0;
+        unique_observable.clear();
+        term_offset.assign(1, 0);
+        term_code.clear();
+        weight.clear();
+        multiplicity.clear();
+        group_offset.clear();
+        group_members.clear();
+        group_shared_terms.clear();
+        unique_of_hash.clear();
+    }
+
+    //
+    // The following function adds an observable with the Pauli operators in codes (which are sorted in place).
+    //
+    void add(std::vector<int>& codes, double observable_weight){
+        std::sort(codes.begin(), codes.end());
+
+        unsigned long long hash = 14695981039346656037ULL;
+        for(int code : codes) hash = (hash ^ (unsigned long long)code) * 1099511628211ULL;
+        unsigned long long weight_bits;
+        memcpy(&weight_bits, &observable_weight, sizeof(weight_bits));
+        hash = (hash ^ weight_bits) * 1099511628211ULL;
+
+        // Look for an identical unique observable among the ones with the same hash
+        auto range = unique_of_hash.equal_range(hash);
+        for(auto it = range.first; it != range.second; ++it){
+            int u = it->second;
+            if(weight[u] == observable_weight && k_local(u) == (int)codes.size()
+               && std::equal(codes.begin(), codes.end(), term_code.begin() + term_offset[u])){
+                unique_observable.push_back(u);
+                multiplicity[u] ++;
+                number_of_observables ++;
+                return;
+            }
+        }
+
+        int u = number_of_unique_observables++;
+        unique_of_hash.insert(std::make_pair(hash, u));
+        term_code.insert(term_code.end(), codes.begin(), codes.end());
+        term_offset.push_back((int)term_code.size());
+        weight.push_back(observable_weight);
+        multiplicity.push_back(1);
+        max_k_local = std::max(max_k_local, (int)codes.size());
+        unique_observable.push_back(u);
+        number_of_observables ++;
+    }
+
+    //
+    // The following function builds the inverted index with two passes over the Pauli operators:
+    // the first pass counts the entries for every (qubit, Pauli), the second pass fills them in.
+    //
+    void build_index(){
+        shadow_profile_phase phase("index build");
+        acting_offset.assign(3 * system_size + 1, 0);
+        for(int code : term_code) acting_offset[code + 1] ++;
+        for(int c = 0; c < 3 * system_size; c++) acting_offset[c + 1] += acting_offset[c];
+
+        acting_observables.resize(term_code.size());
+        std::vector<int> fill_position(acting_offset.begin(), acting_offset.end() - 1);
+        for(int u = 0; u < number_of_unique_observables; u++)
+            for(int term = term_offset[u]; term < term_offset[u+1]; term++)
+                acting_observables[fill_position[term_code[term]]++] = u;
+    }
+
+    //
+    // The following function groups the unique observables by the qubits they act on.
+    // The terms of every unique observable are sorted by qubit, so sorting the unique observables
+    // by (k_local, qubits, Pauli operators) puts every group together, with the shared prefixes next to each other.
+    //
+    void build_support_groups(){
+        shadow_profile_phase phase("support group build");
+        group_members.resize(number_of_unique_observables);
+        for(int u = 0; u < number_of_unique_observables; u++) group_members[u] = u;
+        std::sort(group_members.begin(), group_members.end(), [this](int u1, int u2){
+            if(k_local(u1) != k_local(u2)) return k_local(u1) < k_local(u2);
+            const int* codes1 = term_code.data() + term_offset[u1];
+            const int* codes2 = term_code.data() + term_offset[u2];
+            for(int k = 0; k < k_local(u1); k++)
+                if(codes1[k] / 3 != codes2[k] / 3) return codes1[k] / 3 < codes2[k] / 3;
+            for(int k = 0; k < k_local(u1); k++)
+                if(codes1[k] != codes2[k]) return codes1[k] < codes2[k];
+            return u1 < u2;
+        });
+
+        group_offset.clear();
+        group_shared_terms.assign(number_of_unique_observables, 0);
+        for(int m = 0; m < number_of_unique_observables; m++){
+            int u = group_members[m];
+            bool same_support = false;
+            if(m > 0 && k_local(group_members[m-1]) == k_local(u)){
+                const int* previous_codes = term_code.data() + term_offset[group_members[m-1]];
+                const int* codes = term_code.data() + term_offset[u];
+                same_support = true;
+                for(int k = 0; k < k_local(u) && same_support; k++) same_support = (previous_codes[k] / 3 == codes[k] / 3);
+                if(same_support)
+                    while(group_shared_terms[m] < k_local(u) && previous_codes[group_shared_terms[m]] == codes[group_shared_terms[m]])
+                        group_shared_terms[m] ++;
+            }
+            if(!same_support) group_offset.push_back(m);
+        }
+        group_offset.push_back(number_of_unique_observables);
+    }
+
+    //
+    // The following function removes the unique observables with is_removed(u) == true
+    // from the inverted index, keeping the order of the remaining entries.
+    //
+    template<class predicate>
+    void remove_from_index(predicate is_removed){
+        int kept = 0;
+        for(int c = 0; c < 3 * system_size; c++){
+            int begin = acting_offset[c], end = acting_offset[c + 1];
+            acting_offset[c] = kept;
+            for(int entry = begin; entry < end; entry++)
+                if(!is_removed(acting_observables[entry]))
+                    acting_observables[kept++] = acting_observables[entry];
+        }
+        acting_offset[3 * system_size] = kept;
+        acting_observables.resize(kept);
+    }
+
+private:
+    std::unordered_multimap<unsigned long long, int> unique_of_hash;
+};
+
+//
+// The following set holds the subsystems whose entanglement entropy is predicted,
+// in the order of the file: subsystems[s] lists the qubits of the s-th subsystem.
+//
+class qubit_subsystem_set{
+public:
+    int system_size;
+    std::vector<std::vector<int> > subsystems;
+
+    //
+    // The following function reads the file: subsystem_file_name.
+    // If system_size is -1, the system size is taken from the file.
+    //
+    void read(const char* subsystem_file_name, int system_size){
+        shadow_text_file subsystem_file;
+        subsystem_file.open(subsystem_file_name);
+        read(subsystem_file, system_size);
+    }
+
+    void parse(const char* text, size_t length, int system_size){
+        shadow_text_file subsystem_file;
+        subsystem_file.assign("(subsystems in memory)", text, text + length);
+        read(subsystem_file, system_size);
+    }
+
+    void read(shadow_text_file& subsystem_file, int system_size){
+        // Read in the system size
+        if(!subsystem_file.next_line()) subsystem_file.report_malformed("the system size");
+        int system_size_subsystem = subsystem_file.read_int("the system size");
+        this->system_size = (system_size == -1)? system_size_subsystem: system_size;
+
+        // Read in the subsystems line by line
+        subsystems.clear();
+        while(subsystem_file.next_line()){
+            int k_local = subsystem_file.read_int("the size of the subsystem");
+
+            std::vector<int> ith_subsystem;
+            for(int k = 0; k < k_local; k++){
+                int position_of_the_qubit = subsystem_file.read_position(this->system_size);
+                ith_subsystem.push_back(position_of_the_qubit);
+            }
+
+            subsystems.push_back(ith_subsystem);
+        }
+    }
+
+    int size() const{
+        return (int)subsystems.size();
+    }
+    const std::vector<int>& operator[](int s) const{
+        return subsystems[s];
+    }
+};
+
+#endif
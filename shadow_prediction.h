@@ -0,0 +1,1103 @@
+//
+// This code is created by Hsin-Yuan Huang (https://momohuang.github.io/).
+// For more details, see the accompany paper:
+//  "Predicting Many Properties of a Quantum System from Very Few Measurements".
+//
+// The following predictor computes the local observables and the Renyi entanglement entropy
+// from a shadow_measurement_set; prediction_shadow.cpp is a command line program around it.
+// The predictor only holds its options, and every function takes the measurements,
+// the observables, and the subsystems as arguments, so one predictor can be used for many queries.
+//
+#ifndef SHADOW_PREDICTION_H
+#define SHADOW_PREDICTION_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <utility>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <map>
+#include "shadow_io.h"
+#include "shadow_observables.h"
+#include "shadow_measurements.h"
+#include "shadow_profile.h"
+
+//
+// The following function transposes a 64 x 64 bit matrix in place:
+// bit c of a[r] is moved to bit r of a[c].
+//
+inline void transpose_64x64(unsigned long long a[64]){
+    unsigned long long m = 0x00000000FFFFFFFFULL;
+    for(int j = 32; j != 0; j >>= 1, m ^= m << j){
+        for(int k = 0; k < 64; k = ((k | j) + 1) & ~j){
+            unsigned long long t = ((a[k] >> j) ^ a[k | j]) & m;
+            a[k | j] ^= t;
+            a[k] ^= t << j;
+        }
+    }
+}
+
+//
+// The bit-plane engine processes a tile of [64 * BITPLANE_LANES] shots at once.
+// The tile is transposed to a qubit-major layout:
+//   bitplane_tile[(ith_qubit * 4 + pauli) * BITPLANE_LANES + lane]
+// has its r-th bit set if the (64 * lane + r)-th shot of the tile
+// measured ith_qubit in the basis pauli (X -> 0, Y -> 1, Z -> 2),
+// and pauli = 3 holds the bits of the -1 outcomes.
+// An observable is measured in a shot if all of its Pauli operators match,
+// which is an AND over its k qubits; the outcome is the XOR of the outcome bits.
+// Four lanes of 64 shots fill a 256-bit AVX2 register when compiled with -mavx2.
+//
+const int BITPLANE_LANES = 4;
+const int BITPLANE_TILE_SHOTS = 64 * BITPLANE_LANES;
+
+//
+// The following workspaces store, for every Pauli operator on the k qubits of a subsystem,
+// the sum of the binary outcomes and the number of outcomes.
+// The Pauli operator is encoded with 2 bits per qubit (I -> 0, X -> 1, Y -> 2, Z -> 3).
+//
+// renyi_dense_counts has one entry for each of the 4^k Pauli operators.
+// renyi_sparse_counts is an open-addressing hash table with one entry for each Pauli operator that is measured:
+// a shot only measures 2^k of the 4^k Pauli operators, so T shots use at most T * 2^k entries.
+// Both call visit(encoding, sum of binary outcomes, number of outcomes) in for_each_repeated
+// for every Pauli operator measured at least twice (or minimum_number_of_outcomes times), in increasing order of the encoding.
+//
+struct renyi_dense_counts{
+    // counts[2 c] is the sum of the binary outcomes and counts[2 c + 1] the number of outcomes of the Pauli operator c,
+    // so that both are in the same cache line
+    std::vector<double> counts;
+
+    void reset(int subsystem_size){
+        counts.assign(2LL << (2 * subsystem_size), 0);
+    }
+    void release(){
+        std::vector<double>().swap(counts);
+    }
+    inline void add(long long encoding, long long binary_outcome){
+        counts[2 * encoding] += binary_outcome;
+        counts[2 * encoding + 1] += 1;
+    }
+    template<class visitor>
+    void for_each_repeated(visitor visit, double minimum_number_of_outcomes = 2) const{
+        for(long long c = 0; 2 * c < (long long)counts.size(); c++)
+            if(counts[2 * c + 1] >= minimum_number_of_outcomes) visit(c, counts[2 * c], counts[2 * c + 1]);
+    }
+};
+
+struct renyi_sparse_counts{
+    struct slot_type{
+        long long encoding; // -1 marks an empty slot
+        int sum_of_binary_outcome, number_of_outcomes;
+    };
+    std::vector<slot_type> slots;
+    long long number_of_entries;
+    int hash_shift; // 64 - log2(number of slots)
+
+    static long long number_of_slots_for(long long expected_entries){
+        long long number_of_slots = 64;
+        while(number_of_slots < 2 * expected_entries) number_of_slots *= 2;
+        return number_of_slots;
+    }
+    void reset(long long expected_entries){
+        long long number_of_slots = number_of_slots_for(expected_entries);
+        slot_type empty_slot = {-1, 0, 0};
+        slots.assign(number_of_slots, empty_slot);
+        number_of_entries = 0;
+        hash_shift = 64 - __builtin_ctzll(number_of_slots);
+    }
+    void release(){
+        std::vector<slot_type>().swap(slots);
+    }
+    inline long long first_slot(long long encoding) const{
+        return (long long)(((unsigned long long)encoding * 0x9E3779B97F4A7C15ULL) >> hash_shift);
+    }
+    inline void add(long long encoding, long long binary_outcome){
+        long long mask = (long long)slots.size() - 1;
+        long long slot = first_slot(encoding);
+        while(slots[slot].encoding != encoding){
+            if(slots[slot].encoding == -1){
+                // Keep at least half of the slots empty
+                if(2 * (number_of_entries + 1) > (long long)slots.size()){
+                    grow();
+                    add(encoding, binary_outcome);
+                    return;
+                }
+                slots[slot].encoding = encoding;
+                number_of_entries ++;
+                break;
+            }
+            slot = (slot + 1) & mask;
+        }
+        slots[slot].sum_of_binary_outcome += (int)binary_outcome;
+        slots[slot].number_of_outcomes += 1;
+    }
+    void grow(){
+        renyi_sparse_counts larger;
+        larger.reset(slots.size());
+        long long mask = (long long)larger.slots.size() - 1;
+        for(auto& entry : slots){
+            if(entry.encoding == -1) continue;
+            long long slot = larger.first_slot(entry.encoding);
+            while(larger.slots[slot].encoding != -1) slot = (slot + 1) & mask;
+            larger.slots[slot] = entry;
+        }
+        larger.number_of_entries = number_of_entries;
+        std::swap(*this, larger);
+    }
+    template<class visitor>
+    void for_each_repeated(visitor visit, int minimum_number_of_outcomes = 2) const{
+        std::vector<std::pair<long long, long long> > repeated; // (encoding, slot)
+        for(long long slot = 0; slot < (long long)slots.size(); slot++)
+            if(slots[slot].encoding != -1 && slots[slot].number_of_outcomes >= minimum_number_of_outcomes) repeated.push_back(std::make_pair(slots[slot].encoding, slot));
+        std::sort(repeated.begin(), repeated.end());
+        for(auto& entry : repeated)
+            visit(entry.first, (double)slots[entry.second].sum_of_binary_outcome, (double)slots[entry.second].number_of_outcomes);
+    }
+};
+
+inline long long renyi_dense_bytes(int subsystem_size){
+    return (2 * sizeof(double)) << (2 * subsystem_size);
+}
+inline long long renyi_sparse_bytes(int subsystem_size, long long number_of_shots){
+    long long measured_paulis = std::min(number_of_shots << subsystem_size, 1LL << (2 * subsystem_size));
+    return renyi_sparse_counts::number_of_slots_for(measured_paulis) * sizeof(renyi_sparse_counts::slot_type);
+}
+
+//
+// The following workspace holds the counts of a subsystem in the dense or the sparse form.
+//
+struct renyi_counts_workspace{
+    bool is_sparse;
+    renyi_dense_counts dense_counts;
+    renyi_sparse_counts sparse_counts;
+
+    void reset(int subsystem_size, bool sparse, long long number_of_shots){
+        is_sparse = sparse;
+        if(is_sparse) sparse_counts.reset(std::min(number_of_shots << subsystem_size, 1LL << (2 * subsystem_size)));
+        else dense_counts.reset(subsystem_size);
+    }
+    void release(){
+        dense_counts.release();
+        sparse_counts.release();
+    }
+    inline void add(long long encoding, long long binary_outcome){
+        if(is_sparse) sparse_counts.add(encoding, binary_outcome);
+        else dense_counts.add(encoding, binary_outcome);
+    }
+
+    // Every Pauli operator measured at least once, in increasing order of the encoding
+    template<class visitor>
+    void for_each_measured(visitor visit) const{
+        if(is_sparse) sparse_counts.for_each_repeated(visit, 1);
+        else dense_counts.for_each_repeated(visit, 1);
+    }
+};
+
+//
+// Subsystems that share a prefix of qubits (in the order given in [subsystem.txt]) are grouped into chains,
+// in which every subsystem is a prefix of the next one, e.g. {0}, {0, 1}, {0, 1, 2}.
+// The Pauli operators on the first j qubits of a subsystem are the first 2^j steps of its gray code iteration,
+// so one gray code iteration over the longest subsystem of a chain fills the counts of every subsystem in the chain,
+// and the measurement data is scanned once per chain instead of once per subsystem.
+//
+struct renyi_chain{
+    std::vector<int> qubits; // the longest subsystem of the chain
+    std::vector<int> prefix_sizes; // in increasing order
+    std::vector<std::vector<int> > subsystem_indices; // the (identical) subsystems for every prefix size
+};
+
+inline std::vector<renyi_chain> build_renyi_chains(const qubit_subsystem_set& subsystems, std::vector<int> subsystem_indices){
+    std::stable_sort(subsystem_indices.begin(), subsystem_indices.end(), [&subsystems](int s1, int s2){
+        return subsystems[s1].size() > subsystems[s2].size();
+    });
+
+    std::vector<renyi_chain> chains;
+    std::map<std::vector<int>, int> chain_of_prefix;
+    for(int s : subsystem_indices){
+        auto found = chain_of_prefix.find(subsystems[s]);
+        if(found != chain_of_prefix.end()){
+            // The subsystems are visited from the longest, so s is the shortest subsystem of the chain so far
+            renyi_chain& chain = chains[found->second];
+            if(chain.prefix_sizes.back() == (int)subsystems[s].size()) chain.subsystem_indices.back().push_back(s);
+            else{
+                chain.prefix_sizes.push_back((int)subsystems[s].size());
+                chain.subsystem_indices.push_back(std::vector<int>(1, s));
+            }
+            continue;
+        }
+
+        renyi_chain chain;
+        chain.qubits = subsystems[s];
+        chain.prefix_sizes.push_back((int)subsystems[s].size());
+        chain.subsystem_indices.push_back(std::vector<int>(1, s));
+        for(int j = 1; j <= (int)subsystems[s].size(); j++)
+            chain_of_prefix.insert(std::make_pair(std::vector<int>(subsystems[s].begin(), subsystems[s].begin() + j), (int)chains.size()));
+        chains.push_back(chain);
+    }
+
+    for(auto& chain : chains){
+        std::reverse(chain.prefix_sizes.begin(), chain.prefix_sizes.end());
+        std::reverse(chain.subsystem_indices.begin(), chain.subsystem_indices.end());
+    }
+    return chains;
+}
+
+//
+// The following functions predict the Renyi entanglement entropy of the subsystems in a chain.
+// accumulate_renyi_counts adds the shots from first_shot to last_shot-1 to the workspace of every prefix size,
+// and renyi_entropy_from_counts computes the prediction from a workspace.
+//
+const int RENYI_CHUNK_SIZE = 1024;
+
+inline void accumulate_renyi_counts(const shadow_measurement_set& measurements, const renyi_chain& chain, int first_shot, int last_shot,
+                                    std::vector<renyi_counts_workspace>& workspaces){
+    const std::vector<int>& subsystem = chain.qubits;
+    int subsystem_size = (int)subsystem.size();
+    int number_of_prefixes = (int)chain.prefix_sizes.size();
+
+    // The dense counts are updated through a plain pointer (NULL for the sparse counts)
+    std::vector<double*> dense_counts(number_of_prefixes, (double*)NULL);
+    for(int m = 0; m < number_of_prefixes; m++)
+        if(!workspaces[m].is_sparse) dense_counts[m] = workspaces[m].dense_counts.counts.data();
+
+    // The gray code iteration is cut into chunks of RENYI_CHUNK_SIZE steps:
+    // the encodings and outcomes of a chunk are computed first, and then added to every prefix that contains them
+    std::vector<long long> chunk_encoding(RENYI_CHUNK_SIZE);
+    std::vector<int> chunk_outcome(RENYI_CHUNK_SIZE);
+    std::vector<long long> encoding_change(subsystem_size);
+    std::vector<int> binary_outcome(subsystem_size);
+
+    for(int t = first_shot; t < last_shot; t++){
+        for(int i = 0; i < subsystem_size; i++){
+            encoding_change[i] = (long long)(measurements.pauli_basis(t, subsystem[i]) + 1) << (2LL * i);
+            binary_outcome[i] = measurements.binary_outcome(t, subsystem[i]);
+        }
+
+        // Using gray code iteration over all 2^n possible outcomes
+        long long encoding = 0;
+        int cumulative_outcome = 1;
+        for(long long chunk_start = 0; chunk_start < (1LL << subsystem_size); chunk_start += RENYI_CHUNK_SIZE){
+            int chunk_size = (int)std::min((long long)RENYI_CHUNK_SIZE, (1LL << subsystem_size) - chunk_start);
+            for(int e = 0; e < chunk_size; e++){
+                long long b = chunk_start + e;
+                if(b > 0){
+                    int change_i = __builtin_ctzll(b);
+                    cumulative_outcome *= binary_outcome[change_i];
+                    encoding ^= encoding_change[change_i];
+                }
+                chunk_encoding[e] = encoding;
+                chunk_outcome[e] = cumulative_outcome;
+            }
+
+            // The first 2^j steps are the Pauli operators on the first j qubits
+            for(int m = 0; m < number_of_prefixes; m++){
+                int prefix_end = (int)std::min((long long)chunk_size, (1LL << chain.prefix_sizes[m]) - chunk_start);
+                if(dense_counts[m] != NULL){
+                    double* counts = dense_counts[m];
+                    for(int e = 0; e < prefix_end; e++){
+                        counts[2 * chunk_encoding[e]] += chunk_outcome[e];
+                        counts[2 * chunk_encoding[e] + 1] += 1;
+                    }
+                }
+                else{
+                    for(int e = 0; e < prefix_end; e++)
+                        workspaces[m].sparse_counts.add(chunk_encoding[e], chunk_outcome[e]);
+                }
+            }
+        }
+    }
+}
+
+template<class renyi_counts>
+double renyi_entropy_from_counts(int subsystem_size, const renyi_counts& counts){
+    // level_ttl[l] = (k choose l) * 3^l is the number of Pauli operators with l non-identity factors,
+    // level_cnt[l] is how many of them are measured at least twice
+    std::vector<long long> level_cnt(subsystem_size + 1, 0), level_ttl(subsystem_size + 1, 0);
+    long long binomial = 1, power_of_three = 1;
+    for(int l = 0; l <= subsystem_size; l++){
+        level_ttl[l] = binomial * power_of_three;
+        binomial = binomial * (subsystem_size - l) / (l + 1);
+        power_of_three *= 3;
+    }
+
+    auto number_of_non_identity = [](long long c){
+        return __builtin_popcountll((c | (c >> 1)) & 0x5555555555555555LL);
+    };
+    counts.for_each_repeated([&](long long c, double, double){
+        level_cnt[number_of_non_identity(c)] ++;
+    });
+
+    double predicted_entropy = 0;
+    counts.for_each_repeated([&](long long c, double sum_of_binary_outcome, double number_of_outcomes){
+        int nonId = number_of_non_identity(c);
+        predicted_entropy += ((double)1.0) / (number_of_outcomes * (number_of_outcomes - 1)) * (sum_of_binary_outcome * sum_of_binary_outcome - number_of_outcomes) / (1LL << subsystem_size) * level_ttl[nonId] / level_cnt[nonId];
+    });
+
+    return -1.0 * log2(std::min(std::max(predicted_entropy, 1.0 / pow(2.0, subsystem_size)), 1.0 - 1e-9));
+}
+
+inline double renyi_entropy_from_counts(int subsystem_size, const renyi_counts_workspace& workspace){
+    if(workspace.is_sparse) return renyi_entropy_from_counts(subsystem_size, workspace.sparse_counts);
+    return renyi_entropy_from_counts(subsystem_size, workspace.dense_counts);
+}
+
+const int PAIRWISE_BLOCK_SHOTS = 256;
+const int GRAYCODE_MAX_QUBITS = 30;
+const int FUSED_TILE_SHOTS = 16 * BITPLANE_TILE_SHOTS;
+
+class shadow_predictor{
+public:
+    //
+    // The options of the predictor (see set_option for their names on the command line).
+    //
+    int number_of_threads;
+    std::string observable_engine; // the engine used to predict local observables
+    long long renyi_memory_budget; // in bytes
+    std::string renyi_counts_mode;
+    std::string renyi_engine;
+    int number_of_buckets; // 0 means only the empirical mean is computed
+
+    shadow_predictor(): number_of_threads(1), observable_engine("bitplane"), renyi_memory_budget(2048LL << 20),
+                        renyi_counts_mode("auto"), renyi_engine("auto"), number_of_buckets(0){}
+
+    //
+    // The following function sets the option --[name] to value.
+    // It returns false if the predictor has no such option, and throws shadow_error (keeping the old value) if the value is not valid.
+    //
+    bool set_option(const char* name, const char* value){
+        if(strcmp(name, "--engine") == 0){
+            if(strcmp(value, "scalar") != 0 && strcmp(value, "bitplane") != 0 && strcmp(value, "grouped") != 0)
+                throw_shadow_error("the engine \"%s\" is not supported.", value);
+            observable_engine = value;
+        }
+        else if(strcmp(name, "--threads") == 0){
+            int threads = atoi(value);
+            if(threads == 0) threads = std::max(1, (int)std::thread::hardware_concurrency());
+            if(threads < 0)
+                throw_shadow_error("the number of threads should be positive.");
+            number_of_threads = threads;
+        }
+        else if(strcmp(name, "--memory-budget") == 0){
+            long long budget = atoll(value) << 20;
+            if(budget <= 0)
+                throw_shadow_error("the memory budget should be positive.");
+            renyi_memory_budget = budget;
+        }
+        else if(strcmp(name, "--entropy-engine") == 0){
+            if(strcmp(value, "auto") != 0 && strcmp(value, "graycode") != 0 && strcmp(value, "pairwise") != 0)
+                throw_shadow_error("the engine \"%s\" is not supported.", value);
+            renyi_engine = value;
+        }
+        else if(strcmp(name, "--counts") == 0){
+            if(strcmp(value, "auto") != 0 && strcmp(value, "dense") != 0 && strcmp(value, "sparse") != 0)
+                throw_shadow_error("the counts \"%s\" are not supported.", value);
+            renyi_counts_mode = value;
+        }
+        else if(strcmp(name, "--buckets") == 0){
+            int buckets = atoi(value);
+            if(buckets < 0)
+                throw_shadow_error("the number of buckets should be positive.");
+            number_of_buckets = buckets;
+        }
+        else return false;
+        return true;
+    }
+
+    //
+    // The following function splits the shots from first_shot to last_shot-1 into [number_of_threads] contiguous ranges.
+    // Every thread runs the chosen engine on its own range with private accumulators,
+    // and the private accumulators are then added up in the order of the threads.
+    // Since all the accumulators are integers, the result is identical to a single-threaded run.
+    // For every unique observable, [number_of_measurements] counts the shots that measure it
+    // and [sum_of_measurement_results] adds up their outcomes.
+    //
+    void accumulate_observables(const shadow_measurement_set& measurements, const pauli_observable_set& observable_set, int first_shot, int last_shot,
+                                std::vector<int>& number_of_measurements, std::vector<int>& sum_of_measurement_results) const{
+        check_system_size(measurements, observable_set.system_size);
+        shadow_profile_phase phase("accumulate observables");
+        void (*engine)(const shadow_measurement_set&, const pauli_observable_set&, int, int, std::vector<int>&, std::vector<int>&) =
+            (observable_engine == "scalar")? accumulate_observables_scalar:
+            (observable_engine == "grouped")? accumulate_observables_grouped: accumulate_observables_bitplane;
+        if(observable_engine == "grouped" && observable_set.group_offset.empty())
+            throw_shadow_error("the grouped engine needs the support groups of the observables (see build_support_groups).");
+
+        // Give every thread a whole number of bit-plane tiles
+        int number_of_tiles = (last_shot - first_shot + BITPLANE_TILE_SHOTS - 1) / BITPLANE_TILE_SHOTS;
+        int threads_to_use = std::max(1, std::min(number_of_threads, number_of_tiles));
+        if(threads_to_use == 1){
+            engine(measurements, observable_set, first_shot, last_shot, number_of_measurements, sum_of_measurement_results);
+            return;
+        }
+
+        int number_of_unique_observables = observable_set.number_of_unique_observables;
+        std::vector<std::vector<int> > thread_number_of_measurements(threads_to_use, std::vector<int>(number_of_unique_observables, 0));
+        std::vector<std::vector<int> > thread_sum_of_measurement_results(threads_to_use, std::vector<int>(number_of_unique_observables, 0));
+        std::vector<std::thread> workers;
+        for(int th = 0; th < threads_to_use; th++){
+            int thread_first_shot = first_shot + (int)std::min((long long)last_shot - first_shot, (long long)number_of_tiles * th / threads_to_use * BITPLANE_TILE_SHOTS);
+            int thread_last_shot = first_shot + (int)std::min((long long)last_shot - first_shot, (long long)number_of_tiles * (th + 1) / threads_to_use * BITPLANE_TILE_SHOTS);
+            workers.push_back(std::thread(engine, std::cref(measurements), std::cref(observable_set), thread_first_shot, thread_last_shot,
+                                          std::ref(thread_number_of_measurements[th]), std::ref(thread_sum_of_measurement_results[th])));
+        }
+        for(int th = 0; th < threads_to_use; th++){
+            workers[th].join();
+            for(int i = 0; i < number_of_unique_observables; i++){
+                number_of_measurements[i] += thread_number_of_measurements[th][i];
+                sum_of_measurement_results[i] += thread_sum_of_measurement_results[th][i];
+            }
+        }
+    }
+
+    //
+    // The following function splits the shots into [number_of_buckets] contiguous buckets of (almost) equal size
+    // and adds the shots from first_shot to last_shot-1 to the accumulators of their buckets.
+    // The accumulators of all the shots are the sums over the buckets (see add_observable_buckets),
+    // which costs number_of_buckets additions per observable instead of extra work for every shot.
+    // The shots of [measurements] may also be the shots shot_offset, shot_offset+1, ... of a run of total_number_of_shots shots
+    // (e.g., a chunk of shadow_chunked_reader), which are split into buckets as a whole.
+    //
+    void accumulate_observable_buckets(const shadow_measurement_set& measurements, const pauli_observable_set& observable_set, int first_shot, int last_shot,
+                                       std::vector<std::vector<int> >& bucket_number_of_measurements, std::vector<std::vector<int> >& bucket_sum_of_measurement_results,
+                                       int shot_offset = 0, int total_number_of_shots = -1) const{
+        int number_of_shots = (total_number_of_shots < 0)? measurements.number_of_shots: total_number_of_shots;
+        for(int b = 0; b < number_of_buckets; b++){
+            int bucket_first_shot = (int)((long long)number_of_shots * b / number_of_buckets) - shot_offset;
+            int bucket_last_shot = (int)((long long)number_of_shots * (b + 1) / number_of_buckets) - shot_offset;
+            if(std::max(first_shot, bucket_first_shot) < std::min(last_shot, bucket_last_shot))
+                accumulate_observables(measurements, observable_set, std::max(first_shot, bucket_first_shot), std::min(last_shot, bucket_last_shot),
+                                       bucket_number_of_measurements[b], bucket_sum_of_measurement_results[b]);
+        }
+    }
+
+    static void add_observable_buckets(const std::vector<std::vector<int> >& bucket_number_of_measurements, const std::vector<std::vector<int> >& bucket_sum_of_measurement_results,
+                                       std::vector<int>& number_of_measurements, std::vector<int>& sum_of_measurement_results){
+        for(int b = 0; b < (int)bucket_number_of_measurements.size(); b++){
+            for(int i = 0; i < (int)number_of_measurements.size(); i++){
+                number_of_measurements[i] += bucket_number_of_measurements[b][i];
+                sum_of_measurement_results[i] += bucket_sum_of_measurement_results[b][i];
+            }
+        }
+    }
+
+    //
+    // The following function computes the error bars of the u-th unique observable.
+    // Every measurement result is +1 or -1, so the sum of squares is the number of measurements,
+    // and the sample variance only needs the two accumulators.
+    // With fewer than two measurements, the standard error is the worst case 1 / sqrt(max(1, number_of_measurements)).
+    // The median of means is the median over the means of the buckets in which the observable is measured
+    // (see the accompany paper); it is 0 if the observable is not measured at all.
+    // The accumulators are int for a single run, and long long for the merged shards of -m.
+    //
+    template<class count_type>
+    static void observable_error_bars(int u, const std::vector<count_type>& number_of_measurements, const std::vector<count_type>& sum_of_measurement_results,
+                                      const std::vector<std::vector<count_type> >& bucket_number_of_measurements, const std::vector<std::vector<count_type> >& bucket_sum_of_measurement_results,
+                                      double& standard_error, double& median_of_means){
+        double n = number_of_measurements[u], sum = sum_of_measurement_results[u];
+        if(n < 2) standard_error = 1.0 / sqrt(std::max(1.0, n));
+        else standard_error = sqrt(std::max(0.0, (n - sum * sum / n) / (n - 1)) / n);
+
+        std::vector<double> bucket_means;
+        for(int b = 0; b < (int)bucket_number_of_measurements.size(); b++){
+            if(bucket_number_of_measurements[b][u] > 0)
+                bucket_means.push_back(1.0 * bucket_sum_of_measurement_results[b][u] / bucket_number_of_measurements[b][u]);
+        }
+        std::sort(bucket_means.begin(), bucket_means.end());
+        int m = (int)bucket_means.size();
+        if(m == 0) median_of_means = 0;
+        else if(m % 2 == 1) median_of_means = bucket_means[m / 2];
+        else median_of_means = (bucket_means[m / 2 - 1] + bucket_means[m / 2]) / 2;
+    }
+
+    //
+    // The following function predicts the expectation value of every observable in the file (0 if it is not measured).
+    // If standard_errors and median_of_means are not NULL, they receive the error bars of every observable
+    // over [number_of_buckets] buckets of shots (a single bucket if number_of_buckets is 0).
+    //
+    void predict_observables(const shadow_measurement_set& measurements, const pauli_observable_set& observable_set, std::vector<double>& predicted_observables,
+                             std::vector<double>* standard_errors = NULL, std::vector<double>* median_of_means = NULL) const{
+        int number_of_unique_observables = observable_set.number_of_unique_observables;
+        std::vector<int> number_of_measurements(number_of_unique_observables, 0), sum_of_measurement_results(number_of_unique_observables, 0);
+        std::vector<std::vector<int> > bucket_number_of_measurements, bucket_sum_of_measurement_results;
+        if(standard_errors == NULL && median_of_means == NULL)
+            accumulate_observables(measurements, observable_set, 0, measurements.number_of_shots, number_of_measurements, sum_of_measurement_results);
+        else{
+            shadow_predictor bucket_predictor = *this;
+            bucket_predictor.number_of_buckets = std::max(1, number_of_buckets);
+            bucket_number_of_measurements.assign(bucket_predictor.number_of_buckets, std::vector<int>(number_of_unique_observables, 0));
+            bucket_sum_of_measurement_results.assign(bucket_predictor.number_of_buckets, std::vector<int>(number_of_unique_observables, 0));
+            bucket_predictor.accumulate_observable_buckets(measurements, observable_set, 0, measurements.number_of_shots,
+                                                           bucket_number_of_measurements, bucket_sum_of_measurement_results);
+            add_observable_buckets(bucket_number_of_measurements, bucket_sum_of_measurement_results, number_of_measurements, sum_of_measurement_results);
+        }
+
+        predicted_observables.assign(observable_set.number_of_observables, 0);
+        if(standard_errors != NULL) standard_errors->assign(observable_set.number_of_observables, 0);
+        if(median_of_means != NULL) median_of_means->assign(observable_set.number_of_observables, 0);
+        for(int i = 0; i < observable_set.number_of_observables; i++){
+            int u = observable_set.unique_observable[i];
+            if(number_of_measurements[u] > 0) predicted_observables[i] = 1.0 * sum_of_measurement_results[u] / number_of_measurements[u];
+            if(bucket_number_of_measurements.empty()) continue;
+
+            double standard_error, median_of_means_u;
+            observable_error_bars(u, number_of_measurements, sum_of_measurement_results,
+                                  bucket_number_of_measurements, bucket_sum_of_measurement_results, standard_error, median_of_means_u);
+            if(standard_errors != NULL) (*standard_errors)[i] = standard_error;
+            if(median_of_means != NULL) (*median_of_means)[i] = median_of_means_u;
+        }
+    }
+
+    //
+    // The following function predicts the energy of the Hamiltonian sum_u weight[u] * multiplicity[u] * P_u
+    // whose terms P_u are the unique observables of the set (the weights are the coefficients),
+    // where a term that is not measured contributes 0.
+    // The shots are split into [number_of_buckets] buckets (DEFAULT_ENERGY_BUCKETS if it is 0),
+    // and the variance of the energy is the sample variance of the energies of the buckets divided by their number,
+    // which includes the covariance of the terms that are measured by the same shots.
+    // Only integer accumulators are kept for every term, so the weighted sums are taken once at the end.
+    //
+    static const int DEFAULT_ENERGY_BUCKETS = 10;
+
+    void predict_energy(const shadow_measurement_set& measurements, const pauli_observable_set& hamiltonian, double& energy, double& energy_variance) const{
+        int number_of_unique_observables = hamiltonian.number_of_unique_observables;
+        shadow_predictor bucket_predictor = *this;
+        bucket_predictor.number_of_buckets = (number_of_buckets > 0)? number_of_buckets: DEFAULT_ENERGY_BUCKETS;
+        if(bucket_predictor.number_of_buckets < 2)
+            throw_shadow_error("the variance of the energy needs at least 2 buckets.");
+
+        std::vector<std::vector<int> > bucket_number_of_measurements(bucket_predictor.number_of_buckets, std::vector<int>(number_of_unique_observables, 0));
+        std::vector<std::vector<int> > bucket_sum_of_measurement_results(bucket_predictor.number_of_buckets, std::vector<int>(number_of_unique_observables, 0));
+        bucket_predictor.accumulate_observable_buckets(measurements, hamiltonian, 0, measurements.number_of_shots,
+                                                       bucket_number_of_measurements, bucket_sum_of_measurement_results);
+        std::vector<int> number_of_measurements(number_of_unique_observables, 0), sum_of_measurement_results(number_of_unique_observables, 0);
+        add_observable_buckets(bucket_number_of_measurements, bucket_sum_of_measurement_results, number_of_measurements, sum_of_measurement_results);
+
+        energy = weighted_energy(hamiltonian, number_of_measurements, sum_of_measurement_results);
+        std::vector<double> bucket_energies;
+        double mean_of_bucket_energies = 0;
+        for(int b = 0; b < bucket_predictor.number_of_buckets; b++){
+            bucket_energies.push_back(weighted_energy(hamiltonian, bucket_number_of_measurements[b], bucket_sum_of_measurement_results[b]));
+            mean_of_bucket_energies += bucket_energies.back() / bucket_predictor.number_of_buckets;
+        }
+        double sum_of_squares = 0;
+        for(double bucket_energy : bucket_energies)
+            sum_of_squares += (bucket_energy - mean_of_bucket_energies) * (bucket_energy - mean_of_bucket_energies);
+        energy_variance = sum_of_squares / (bucket_predictor.number_of_buckets - 1) / bucket_predictor.number_of_buckets;
+    }
+
+    static double weighted_energy(const pauli_observable_set& hamiltonian, const std::vector<int>& number_of_measurements, const std::vector<int>& sum_of_measurement_results){
+        double energy = 0;
+        for(int u = 0; u < hamiltonian.number_of_unique_observables; u++)
+            if(number_of_measurements[u] > 0)
+                energy += hamiltonian.weight[u] * hamiltonian.multiplicity[u] * sum_of_measurement_results[u] / number_of_measurements[u];
+        return energy;
+    }
+
+    //
+    // The following function chooses the workspace of a subsystem of size k for a given number of shots.
+    // [renyi_counts_mode] "auto" uses the sparse workspace when it takes at most a quarter of the memory of the dense one.
+    //
+    bool use_sparse_renyi_counts(int subsystem_size, long long number_of_shots) const{
+        if(renyi_counts_mode != "auto") return renyi_counts_mode == "sparse";
+        return 4 * renyi_sparse_bytes(subsystem_size, number_of_shots) <= renyi_dense_bytes(subsystem_size);
+    }
+
+    long long renyi_chain_bytes(const renyi_chain& chain, long long number_of_shots) const{
+        long long workspace_bytes = 0;
+        for(int prefix_size : chain.prefix_sizes){
+            workspace_bytes += use_sparse_renyi_counts(prefix_size, number_of_shots)?
+                renyi_sparse_bytes(prefix_size, number_of_shots): renyi_dense_bytes(prefix_size);
+        }
+        return workspace_bytes;
+    }
+
+    //
+    // The following function chooses the engine for the Renyi entanglement entropy of a subsystem of size k.
+    // The two engines are different estimators of the purity, so [renyi_engine] "auto" keeps the predictions of the gray code engine
+    // and only takes the pairwise engine for the subsystems that the gray code engine cannot enumerate (k > GRAYCODE_MAX_QUBITS).
+    //
+    bool use_pairwise_renyi_engine(int subsystem_size) const{
+        if(renyi_engine != "auto") return renyi_engine == "pairwise";
+        return subsystem_size > GRAYCODE_MAX_QUBITS;
+    }
+
+    //
+    // The following function predicts the Renyi entanglement entropy of a single subsystem from pairs of shots.
+    // For two shots i != j, the classical shadows on the k qubits of the subsystem satisfy
+    //   tr(rho_i rho_j) = 5^a (-4)^b (1/2)^c,
+    // where a qubits are measured in the same basis with the same outcome, b in the same basis with
+    // different outcomes, and c in different bases. The purity is the average over all T (T - 1) / 2 pairs,
+    // which takes O(T^2 k / 64) popcounts instead of the O(T 2^k) updates of the gray code iteration.
+    //
+    // The pairs are cut into blocks of PAIRWISE_BLOCK_SHOTS x PAIRWISE_BLOCK_SHOTS,
+    // the rows of blocks are handed out to [number_of_threads] threads,
+    // and the sums of the rows are added up in order, so the result does not depend on the number of threads.
+    //
+    double predict_renyi_entropy_pairwise(const shadow_measurement_set& measurements, const std::vector<int>& subsystem) const{
+        shadow_profile_phase phase("pairwise entropy");
+        int subsystem_size = (int)subsystem.size();
+        int words_per_subsystem = (subsystem_size + 63) / 64;
+        int number_of_shots = measurements.number_of_shots;
+
+        // Pack the basis (two bits) and the outcome of the qubits in the subsystem:
+        // the shot t uses the words from (3 t) * words_per_subsystem to (3 t + 3) * words_per_subsystem - 1
+        std::vector<unsigned long long> packed_shots((size_t)number_of_shots * 3 * words_per_subsystem, 0);
+        for(int t = 0; t < number_of_shots; t++){
+            unsigned long long* shot = &packed_shots[(size_t)t * 3 * words_per_subsystem];
+            for(int i = 0; i < subsystem_size; i++){
+                int pauli_basis = measurements.pauli_basis(t, subsystem[i]);
+                unsigned long long bit = 1ULL << (i % 64);
+                if(pauli_basis & 1) shot[i / 64] |= bit;
+                if(pauli_basis & 2) shot[words_per_subsystem + i / 64] |= bit;
+                if(measurements.binary_outcome(t, subsystem[i]) == -1) shot[2 * words_per_subsystem + i / 64] |= bit;
+            }
+        }
+        std::vector<unsigned long long> valid_qubits(words_per_subsystem, ~0ULL);
+        if(subsystem_size % 64 != 0) valid_qubits[words_per_subsystem - 1] = (1ULL << (subsystem_size % 64)) - 1;
+
+        // pair_value[a * (k + 1) + b] = 5^a (-4)^b (1/2)^(k - a - b)
+        std::vector<double> pair_value((subsystem_size + 1) * (subsystem_size + 1), 0);
+        for(int a = 0; a <= subsystem_size; a++)
+            for(int b = 0; a + b <= subsystem_size; b++)
+                pair_value[a * (subsystem_size + 1) + b] = pow(5.0, a) * pow(-4.0, b) * pow(0.5, subsystem_size - a - b);
+
+        int number_of_row_blocks = (number_of_shots + PAIRWISE_BLOCK_SHOTS - 1) / PAIRWISE_BLOCK_SHOTS;
+        std::vector<double> row_block_sum(number_of_row_blocks, 0);
+        std::atomic<int> next_row_block(0);
+
+        auto pairwise_worker = [&](){
+            for(int rb = next_row_block++; rb < number_of_row_blocks; rb = next_row_block++){
+                int row_end = std::min(number_of_shots, (rb + 1) * PAIRWISE_BLOCK_SHOTS);
+                double sum = 0;
+                for(int cb = rb; cb < number_of_row_blocks; cb++){
+                    int column_end = std::min(number_of_shots, (cb + 1) * PAIRWISE_BLOCK_SHOTS);
+                    for(int i = rb * PAIRWISE_BLOCK_SHOTS; i < row_end; i++){
+                        const unsigned long long* shot_i = &packed_shots[(size_t)i * 3 * words_per_subsystem];
+                        for(int j = std::max(i + 1, cb * PAIRWISE_BLOCK_SHOTS); j < column_end; j++){
+                            const unsigned long long* shot_j = &packed_shots[(size_t)j * 3 * words_per_subsystem];
+                            int same_outcome = 0, different_outcome = 0;
+                            for(int w = 0; w < words_per_subsystem; w++){
+                                unsigned long long same_basis = ~((shot_i[w] ^ shot_j[w]) | (shot_i[words_per_subsystem + w] ^ shot_j[words_per_subsystem + w])) & valid_qubits[w];
+                                unsigned long long flipped = shot_i[2 * words_per_subsystem + w] ^ shot_j[2 * words_per_subsystem + w];
+                                same_outcome += __builtin_popcountll(same_basis & ~flipped);
+                                different_outcome += __builtin_popcountll(same_basis & flipped);
+                            }
+                            sum += pair_value[same_outcome * (subsystem_size + 1) + different_outcome];
+                        }
+                    }
+                }
+                row_block_sum[rb] = sum;
+            }
+        };
+
+        int threads_to_use = std::max(1, std::min(number_of_threads, number_of_row_blocks));
+        std::vector<std::thread> workers;
+        for(int th = 1; th < threads_to_use; th++)
+            workers.push_back(std::thread(pairwise_worker));
+        pairwise_worker();
+        for(int th = 0; th < (int)workers.size(); th++)
+            workers[th].join();
+
+        double predicted_entropy = 0;
+        if(number_of_shots >= 2){
+            for(int rb = 0; rb < number_of_row_blocks; rb++) predicted_entropy += row_block_sum[rb];
+            predicted_entropy /= 0.5 * number_of_shots * (number_of_shots - 1.0);
+        }
+        return -1.0 * log2(std::min(std::max(predicted_entropy, 1.0 / pow(2.0, subsystem_size)), 1.0 - 1e-9));
+    }
+
+    //
+    // The following function predicts the Renyi entanglement entropy of all [subsystems]
+    // and stores them in [predicted_entropies] in the order of the input.
+    // The subsystems for the pairwise engine are predicted one at a time with all [number_of_threads] threads.
+    // The other subsystems are grouped into chains (see build_renyi_chains),
+    // which are handed out to [number_of_threads] workers one at a time.
+    // A worker may only allocate the workspaces of a chain
+    // if the workspaces held by all workers fit in [renyi_memory_budget];
+    // a chain larger than the whole budget runs once no other workspace is held.
+    //
+    void predict_entropies(const shadow_measurement_set& measurements, const qubit_subsystem_set& subsystems, std::vector<double>& predicted_entropies) const{
+        check_system_size(measurements, subsystems.system_size);
+        int number_of_shots = measurements.number_of_shots;
+        predicted_entropies.assign(subsystems.size(), 0);
+        std::vector<int> graycode_subsystems;
+        for(int s = 0; s < subsystems.size(); s++){
+            int subsystem_size = (int)subsystems[s].size();
+            if(use_pairwise_renyi_engine(subsystem_size))
+                predicted_entropies[s] = predict_renyi_entropy_pairwise(measurements, subsystems[s]);
+            else if(subsystem_size > GRAYCODE_MAX_QUBITS)
+                throw_shadow_error("the gray code engine supports subsystems of at most %d qubits.", GRAYCODE_MAX_QUBITS);
+            else graycode_subsystems.push_back(s);
+        }
+
+        std::vector<renyi_chain> chains = build_renyi_chains(subsystems, graycode_subsystems);
+        std::mutex renyi_memory_mutex;
+        std::condition_variable renyi_memory_released;
+        long long renyi_memory_in_use = 0;
+        std::atomic<int> next_chain_to_predict(0);
+
+        auto renyi_entropy_worker = [&](){
+            std::vector<renyi_counts_workspace> workspaces;
+
+            for(int c = next_chain_to_predict++; c < (int)chains.size(); c = next_chain_to_predict++){
+                long long workspace_bytes = renyi_chain_bytes(chains[c], number_of_shots);
+                {
+                    std::unique_lock<std::mutex> lock(renyi_memory_mutex);
+                    while(renyi_memory_in_use > 0 && renyi_memory_in_use + workspace_bytes > renyi_memory_budget)
+                        renyi_memory_released.wait(lock);
+                    renyi_memory_in_use += workspace_bytes;
+                }
+
+                predict_renyi_entropies(measurements, chains[c], workspaces, predicted_entropies);
+
+                // Return the workspaces before waking up the other workers
+                for(auto& workspace : workspaces) workspace.release();
+                {
+                    std::lock_guard<std::mutex> lock(renyi_memory_mutex);
+                    renyi_memory_in_use -= workspace_bytes;
+                }
+                renyi_memory_released.notify_all();
+            }
+        };
+
+        int threads_to_use = std::max(1, std::min(number_of_threads, (int)chains.size()));
+        std::vector<std::thread> workers;
+        for(int th = 1; th < threads_to_use; th++)
+            workers.push_back(std::thread(renyi_entropy_worker));
+        renyi_entropy_worker();
+        for(int th = 0; th < (int)workers.size(); th++)
+            workers[th].join();
+    }
+
+    //
+    // The following function predicts the local observables and the entanglement entropy of the subsystems
+    // with a single scan over the measurement data.
+    // The shots are processed in tiles of FUSED_TILE_SHOTS, which stay in the cache,
+    // and every tile is added to the accumulators of all the observables and all the chains of subsystems
+    // (see build_renyi_chains) before moving on to the next tile; the chains of a tile are handed out to [number_of_threads] threads.
+    // If the workspaces of all the chains do not fit in [renyi_memory_budget],
+    // the chains are split into groups that fit, and the measurement data is scanned once for every group.
+    // The subsystems for the pairwise engine are predicted afterwards.
+    // The observables are added to the buckets if [number_of_buckets] is positive, and to the totals otherwise.
+    //
+    void predict_observables_and_entropies(const shadow_measurement_set& measurements, const pauli_observable_set& observable_set, const qubit_subsystem_set& subsystems,
+                                           std::vector<int>& number_of_measurements, std::vector<int>& sum_of_measurement_results,
+                                           std::vector<std::vector<int> >& bucket_number_of_measurements, std::vector<std::vector<int> >& bucket_sum_of_measurement_results,
+                                           std::vector<double>& predicted_entropies) const{
+        check_system_size(measurements, subsystems.system_size);
+        int number_of_shots = measurements.number_of_shots;
+        predicted_entropies.assign(subsystems.size(), 0);
+        std::vector<int> graycode_subsystems, pairwise_subsystems;
+        for(int s = 0; s < subsystems.size(); s++){
+            int subsystem_size = (int)subsystems[s].size();
+            if(use_pairwise_renyi_engine(subsystem_size)) pairwise_subsystems.push_back(s);
+            else if(subsystem_size > GRAYCODE_MAX_QUBITS)
+                throw_shadow_error("the gray code engine supports subsystems of at most %d qubits.", GRAYCODE_MAX_QUBITS);
+            else graycode_subsystems.push_back(s);
+        }
+        std::vector<renyi_chain> chains = build_renyi_chains(subsystems, graycode_subsystems);
+
+        // Split the chains into groups whose workspaces fit in the memory budget (a chain larger than the budget is a group of its own)
+        std::vector<int> group_first_chain(1, 0);
+        long long group_bytes = 0;
+        for(int c = 0; c < (int)chains.size(); c++){
+            long long chain_bytes = renyi_chain_bytes(chains[c], number_of_shots);
+            if(group_bytes > 0 && group_bytes + chain_bytes > renyi_memory_budget){
+                group_first_chain.push_back(c);
+                group_bytes = 0;
+            }
+            group_bytes += chain_bytes;
+        }
+        group_first_chain.push_back((int)chains.size());
+
+        int number_of_groups = std::max(1, (int)group_first_chain.size() - 1);
+        for(int g = 0; g < number_of_groups; g++){
+            int first_chain = group_first_chain[g], last_chain = (g + 1 < (int)group_first_chain.size())? group_first_chain[g + 1]: first_chain;
+
+            std::vector<std::vector<renyi_counts_workspace> > workspaces(last_chain - first_chain);
+            for(int c = first_chain; c < last_chain; c++){
+                workspaces[c - first_chain].resize(chains[c].prefix_sizes.size());
+                for(int m = 0; m < (int)chains[c].prefix_sizes.size(); m++){
+                    int subsystem_size = chains[c].prefix_sizes[m];
+                    workspaces[c - first_chain][m].reset(subsystem_size, use_sparse_renyi_counts(subsystem_size, number_of_shots), number_of_shots);
+                }
+            }
+
+            for(int tile_shot = 0; tile_shot < number_of_shots; tile_shot += FUSED_TILE_SHOTS){
+                int tile_end = std::min(number_of_shots, tile_shot + FUSED_TILE_SHOTS);
+
+                // The observables are only accumulated in the first scan
+                if(g == 0){
+                    if(number_of_buckets == 0) accumulate_observables(measurements, observable_set, tile_shot, tile_end, number_of_measurements, sum_of_measurement_results);
+                    else accumulate_observable_buckets(measurements, observable_set, tile_shot, tile_end, bucket_number_of_measurements, bucket_sum_of_measurement_results);
+                }
+
+                shadow_profile_phase phase("accumulate entropy counts");
+                std::atomic<int> next_chain(first_chain);
+                auto chain_worker = [&](){
+                    for(int c = next_chain++; c < last_chain; c = next_chain++)
+                        accumulate_renyi_counts(measurements, chains[c], tile_shot, tile_end, workspaces[c - first_chain]);
+                };
+                int threads_to_use = std::max(1, std::min(number_of_threads, last_chain - first_chain));
+                std::vector<std::thread> workers;
+                for(int th = 1; th < threads_to_use; th++)
+                    workers.push_back(std::thread(chain_worker));
+                chain_worker();
+                for(int th = 0; th < (int)workers.size(); th++)
+                    workers[th].join();
+            }
+
+            shadow_profile_phase phase("entropy normalization");
+            for(int c = first_chain; c < last_chain; c++){
+                for(int m = 0; m < (int)chains[c].prefix_sizes.size(); m++){
+                    double predicted_entropy = renyi_entropy_from_counts(chains[c].prefix_sizes[m], workspaces[c - first_chain][m]);
+                    for(int s : chains[c].subsystem_indices[m]) predicted_entropies[s] = predicted_entropy;
+                }
+            }
+        }
+
+        for(int s : pairwise_subsystems)
+            predicted_entropies[s] = predict_renyi_entropy_pairwise(measurements, subsystems[s]);
+    }
+
+private:
+    static void check_system_size(const shadow_measurement_set& measurements, int system_size){
+        if(measurements.system_size != system_size)
+            throw_shadow_error("the system size do not match.");
+    }
+
+    //
+    // The following function runs through the shots from first_shot to last_shot-1
+    // in the packed measurement data one shot at a time,
+    // and updates [number_of_measurements] and [sum_of_measurement_results] for every unique observable.
+    //
+    static void accumulate_observables_scalar(const shadow_measurement_set& measurements, const pauli_observable_set& observable_set, int first_shot, int last_shot,
+                                              std::vector<int>& number_of_measurements, std::vector<int>& sum_of_measurement_results){
+        int system_size = measurements.system_size, words_per_plane = measurements.words_per_plane;
+
+        // For every observable,
+        // how many Pauli operators need to be matched to measure the observable
+        // in the current measurement repetition.
+        int number_of_unique_observables = observable_set.number_of_unique_observables;
+        std::vector<int> how_many_pauli_to_match;
+        how_many_pauli_to_match.resize(number_of_unique_observables);
+
+        // For every observable,
+        // store the measurement up to this single-qubit measurement.
+        std::vector<int> cumulative_measurement;
+        cumulative_measurement.resize(number_of_unique_observables);
+
+        for(int t = first_shot; t < last_shot; t++){
+            for(int i = 0; i < number_of_unique_observables; i++){
+                how_many_pauli_to_match[i] = observable_set.k_local(i); // initialize to k for k-local observable
+                cumulative_measurement[i] = 1; // initialize to 1
+            }
+
+            const unsigned long long* shot = measurements.shot(t);
+            for(int word = 0; word < words_per_plane; word++){
+                unsigned long long low_bits = shot[word];
+                unsigned long long high_bits = shot[words_per_plane + word];
+                unsigned long long outcome_bits = shot[2 * words_per_plane + word];
+
+                int last_qubit = std::min(system_size, 64 * (word + 1));
+                for(int ith_qubit = 64 * word; ith_qubit < last_qubit; ith_qubit++){
+                    int pauli = (int)(low_bits & 1) | ((int)(high_bits & 1) << 1);
+                    int binary_outcome = 1 - 2 * (int)(outcome_bits & 1);
+                    low_bits >>= 1; high_bits >>= 1; outcome_bits >>= 1;
+
+                    for(const int* i = observable_set.acting_begin(ith_qubit, pauli); i != observable_set.acting_end(ith_qubit, pauli); i++){
+                        how_many_pauli_to_match[*i] --;
+                        cumulative_measurement[*i] *= binary_outcome;
+                    }
+                }
+            }
+
+            for(int i = 0; i < number_of_unique_observables; i++){
+                if(how_many_pauli_to_match[i] == 0){
+                    number_of_measurements[i] ++;
+                    sum_of_measurement_results[i] += cumulative_measurement[i];
+                }
+            }
+        }
+    }
+
+    static void build_bitplane_tile(const shadow_measurement_set& measurements, int first_shot, int last_shot,
+                                    std::vector<unsigned long long>& bitplane_tile, unsigned long long valid_shots[BITPLANE_LANES]){
+        int system_size = measurements.system_size, words_per_plane = measurements.words_per_plane;
+        unsigned long long low_block[64], high_block[64], outcome_block[64];
+
+        for(int lane = 0; lane < BITPLANE_LANES; lane++){
+            int block_shot = first_shot + 64 * lane;
+            int shots_in_block = std::max(0, std::min(64, last_shot - block_shot));
+            valid_shots[lane] = (shots_in_block == 64)? ~0ULL: (1ULL << shots_in_block) - 1;
+
+            for(int word = 0; word < words_per_plane; word++){
+                for(int r = 0; r < 64; r++){
+                    if(r < shots_in_block){
+                        const unsigned long long* shot = measurements.shot(block_shot + r);
+                        low_block[r] = shot[word];
+                        high_block[r] = shot[words_per_plane + word];
+                        outcome_block[r] = shot[2 * words_per_plane + word];
+                    }
+                    else{
+                        low_block[r] = high_block[r] = outcome_block[r] = 0;
+                    }
+                }
+                transpose_64x64(low_block);
+                transpose_64x64(high_block);
+                transpose_64x64(outcome_block);
+
+                int last_qubit = std::min(system_size - 64 * word, 64);
+                for(int c = 0; c < last_qubit; c++){
+                    unsigned long long* qubit_planes = &bitplane_tile[(64 * word + c) * 4 * BITPLANE_LANES];
+                    qubit_planes[0 * BITPLANE_LANES + lane] = ~(low_block[c] | high_block[c]) & valid_shots[lane];
+                    qubit_planes[1 * BITPLANE_LANES + lane] = low_block[c];
+                    qubit_planes[2 * BITPLANE_LANES + lane] = high_block[c];
+                    qubit_planes[3 * BITPLANE_LANES + lane] = outcome_block[c];
+                }
+            }
+        }
+    }
+
+    //
+    // The following function runs through the shots from first_shot to last_shot-1
+    // in the packed measurement data one tile at a time using the bit-plane engine,
+    // and gives the same [number_of_measurements] and [sum_of_measurement_results]
+    // as accumulate_observables_scalar.
+    //
+    static void accumulate_observables_bitplane(const shadow_measurement_set& measurements, const pauli_observable_set& observable_set, int first_shot, int last_shot,
+                                                std::vector<int>& number_of_measurements, std::vector<int>& sum_of_measurement_results){
+        // The Pauli operators of the i-th unique observable are the entries
+        // from observable_set.term_offset[i] to observable_set.term_offset[i+1]-1,
+        // and each entry is translated to the offset (ith_qubit * 4 + pauli) * BITPLANE_LANES in the tile.
+        int number_of_unique_observables = observable_set.number_of_unique_observables;
+        const std::vector<int>& observable_term_offset = observable_set.term_offset;
+        std::vector<int> observable_term_basis, observable_term_outcome;
+        for(int code : observable_set.term_code){
+            observable_term_basis.push_back(((code / 3) * 4 + code % 3) * BITPLANE_LANES);
+            observable_term_outcome.push_back(((code / 3) * 4 + 3) * BITPLANE_LANES);
+        }
+
+        std::vector<unsigned long long> bitplane_tile((size_t)measurements.system_size * 4 * BITPLANE_LANES);
+        unsigned long long valid_shots[BITPLANE_LANES];
+
+        for(int tile_shot = first_shot; tile_shot < last_shot; tile_shot += BITPLANE_TILE_SHOTS){
+            build_bitplane_tile(measurements, tile_shot, last_shot, bitplane_tile, valid_shots);
+
+            for(int i = 0; i < number_of_unique_observables; i++){
+                unsigned long long match[BITPLANE_LANES], parity[BITPLANE_LANES];
+                for(int lane = 0; lane < BITPLANE_LANES; lane++){
+                    match[lane] = valid_shots[lane];
+                    parity[lane] = 0;
+                }
+
+                for(int term = observable_term_offset[i]; term < observable_term_offset[i+1]; term++){
+                    const unsigned long long* basis = &bitplane_tile[observable_term_basis[term]];
+                    const unsigned long long* outcome = &bitplane_tile[observable_term_outcome[term]];
+                    for(int lane = 0; lane < BITPLANE_LANES; lane++){
+                        match[lane] &= basis[lane];
+                        parity[lane] ^= outcome[lane];
+                    }
+                }
+
+                int count = 0, count_of_minus_one = 0;
+                for(int lane = 0; lane < BITPLANE_LANES; lane++){
+                    count += __builtin_popcountll(match[lane]);
+                    count_of_minus_one += __builtin_popcountll(match[lane] & parity[lane]);
+                }
+                number_of_measurements[i] += count;
+                sum_of_measurement_results[i] += count - 2 * count_of_minus_one;
+            }
+        }
+    }
+
+    //
+    // The following function gives the same [number_of_measurements] and [sum_of_measurement_results]
+    // as accumulate_observables_bitplane, but goes through the support groups of observable_set (see build_support_groups):
+    // the parity of the outcomes on the support is computed once per group and tile,
+    // and the match of every member reuses the Pauli operators it shares with the previous member,
+    // so a full set of 3^k Pauli strings on the same k qubits costs about 1.5 operations per string.
+    //
+    static void accumulate_observables_grouped(const shadow_measurement_set& measurements, const pauli_observable_set& observable_set, int first_shot, int last_shot,
+                                               std::vector<int>& number_of_measurements, std::vector<int>& sum_of_measurement_results){
+        const std::vector<int>& observable_term_offset = observable_set.term_offset;
+        std::vector<int> observable_term_basis, observable_term_outcome;
+        for(int code : observable_set.term_code){
+            observable_term_basis.push_back(((code / 3) * 4 + code % 3) * BITPLANE_LANES);
+            observable_term_outcome.push_back(((code / 3) * 4 + 3) * BITPLANE_LANES);
+        }
+
+        std::vector<unsigned long long> bitplane_tile((size_t)measurements.system_size * 4 * BITPLANE_LANES);
+        unsigned long long valid_shots[BITPLANE_LANES];
+        // prefix_match[k * BITPLANE_LANES + lane] holds the shots that match the first k Pauli operators of the current member
+        std::vector<unsigned long long> prefix_match((observable_set.max_k_local + 1) * BITPLANE_LANES);
+
+        for(int tile_shot = first_shot; tile_shot < last_shot; tile_shot += BITPLANE_TILE_SHOTS){
+            build_bitplane_tile(measurements, tile_shot, last_shot, bitplane_tile, valid_shots);
+
+            for(int g = 0; g < observable_set.number_of_support_groups(); g++){
+                int first_member = observable_set.group_offset[g], last_member = observable_set.group_offset[g+1];
+                int first_observable = observable_set.group_members[first_member];
+
+                unsigned long long parity[BITPLANE_LANES];
+                for(int lane = 0; lane < BITPLANE_LANES; lane++){
+                    prefix_match[lane] = valid_shots[lane];
+                    parity[lane] = 0;
+                }
+                for(int term = observable_term_offset[first_observable]; term < observable_term_offset[first_observable+1]; term++){
+                    const unsigned long long* outcome = &bitplane_tile[observable_term_outcome[term]];
+                    for(int lane = 0; lane < BITPLANE_LANES; lane++) parity[lane] ^= outcome[lane];
+                }
+
+                for(int m = first_member; m < last_member; m++){
+                    int i = observable_set.group_members[m], k_local = observable_set.k_local(i);
+                    for(int k = (m == first_member)? 0: observable_set.group_shared_terms[m]; k < k_local; k++){
+                        const unsigned long long* basis = &bitplane_tile[observable_term_basis[observable_term_offset[i] + k]];
+                        for(int lane = 0; lane < BITPLANE_LANES; lane++)
+                            prefix_match[(k + 1) * BITPLANE_LANES + lane] = prefix_match[k * BITPLANE_LANES + lane] & basis[lane];
+                    }
+
+                    const unsigned long long* match = &prefix_match[k_local * BITPLANE_LANES];
+                    int count = 0, count_of_minus_one = 0;
+                    for(int lane = 0; lane < BITPLANE_LANES; lane++){
+                        count += __builtin_popcountll(match[lane]);
+                        count_of_minus_one += __builtin_popcountll(match[lane] & parity[lane]);
+                    }
+                    number_of_measurements[i] += count;
+                    sum_of_measurement_results[i] += count - 2 * count_of_minus_one;
+                }
+            }
+        }
+    }
+
+    //
+    // The following function predicts the entropy of every prefix of a chain on the calling worker thread of predict_entropies.
+    //
+    void predict_renyi_entropies(const shadow_measurement_set& measurements, const renyi_chain& chain,
+                                 std::vector<renyi_counts_workspace>& workspaces, std::vector<double>& predicted_entropies) const{
+        int number_of_shots = measurements.number_of_shots;
+        int number_of_prefixes = (int)chain.prefix_sizes.size();
+        workspaces.resize(std::max((int)workspaces.size(), number_of_prefixes));
+        for(int m = 0; m < number_of_prefixes; m++)
+            workspaces[m].reset(chain.prefix_sizes[m], use_sparse_renyi_counts(chain.prefix_sizes[m], number_of_shots), number_of_shots);
+
+        {
+            shadow_profile_phase phase("accumulate entropy counts", true);
+            accumulate_renyi_counts(measurements, chain, 0, number_of_shots, workspaces);
+        }
+
+        shadow_profile_phase phase("entropy normalization", true);
+        for(int m = 0; m < number_of_prefixes; m++){
+            double predicted_entropy = renyi_entropy_from_counts(chain.prefix_sizes[m], workspaces[m]);
+            for(int s : chain.subsystem_indices[m]) predicted_entropies[s] = predicted_entropy;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,216 @@
+//
+// This code is created by Hsin-Yuan Huang (https://momohuang.github.io/).
+// For more details, see the accompany paper:
+//  "Predicting Many Properties of a Quantum System from Very Few Measurements".
+//
+// The following profile collects the time spent in every phase of a run (parsing, index build,
+// accumulation, entropy normalization, derandomization, output), counters, and series of samples,
+// and writes them as JSON for the option --profile of the command line programs.
+// There is a single profile for the process (shadow_profile::instance()), which is disabled by default:
+// a phase then costs one branch, and nothing is collected.
+//
+#ifndef SHADOW_PROFILE_H
+#define SHADOW_PROFILE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <algorithm>
+#include "shadow_io.h"
+
+class shadow_profile{
+public:
+    static shadow_profile& instance(){
+        static shadow_profile profile;
+        return profile;
+    }
+
+    bool enabled() const{
+        return is_enabled;
+    }
+
+    void enable(){
+        is_enabled = true;
+        start_wall_time = wall_time();
+        start_cpu_time = process_cpu_time();
+    }
+
+    static double wall_time(){
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec + now.tv_nsec * 1e-9;
+    }
+    static double process_cpu_time(){
+        struct timespec now;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+        return now.tv_sec + now.tv_nsec * 1e-9;
+    }
+    static double thread_cpu_time(){
+        struct timespec now;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+        return now.tv_sec + now.tv_nsec * 1e-9;
+    }
+    static double peak_memory_in_megabytes(){
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss / 1024.0; // ru_maxrss is in kilobytes on Linux
+    }
+
+    //
+    // The following functions add one call of a phase, add to a counter, and add a sample (x, y) to a series.
+    // They may be called from any thread, and do nothing while the profile is disabled.
+    //
+    void add_phase(const char* name, double wall_seconds, double cpu_seconds){
+        if(!is_enabled) return;
+        std::lock_guard<std::mutex> lock(profile_mutex);
+        profile_phase& phase = find(phases, name);
+        phase.calls ++;
+        phase.wall_seconds += wall_seconds;
+        phase.cpu_seconds += cpu_seconds;
+        phase.max_wall_seconds = std::max(phase.max_wall_seconds, wall_seconds);
+    }
+    void add_counter(const char* name, double value){
+        if(!is_enabled) return;
+        std::lock_guard<std::mutex> lock(profile_mutex);
+        find(counters, name).value += value;
+    }
+    void add_sample(const char* name, double x, double y){
+        if(!is_enabled) return;
+        std::lock_guard<std::mutex> lock(profile_mutex);
+        profile_series& series = find(all_series, name);
+        series.samples.push_back(std::make_pair(x, y));
+    }
+
+    //
+    // The following function writes the profile as a JSON object to file_name ("-" for stderr):
+    //   "program", "arguments", the total "wall_seconds" and "cpu_seconds", "peak_rss_mb",
+    //   "phases": {name: {"calls", "wall_seconds", "cpu_seconds", "max_wall_seconds"}},
+    //   "counters": {name: value}, and "series": {name: [[x, y], ...]}.
+    // The phases and counters are listed in the order in which they first occurred.
+    //
+    void write_json(const char* file_name, int argc, char* argv[]){
+        std::lock_guard<std::mutex> lock(profile_mutex);
+        FILE* profile_file = (strcmp(file_name, "-") == 0)? stderr: fopen(file_name, "w");
+        if(profile_file == NULL)
+            throw_shadow_error("the profile \"%s\" cannot be written.", file_name);
+
+        fprintf(profile_file, "{\n  \"program\": \"%s\",\n  \"arguments\": [", json_escaped(argc > 0? argv[0]: "").c_str());
+        for(int a = 1; a < argc; a++) fprintf(profile_file, "%s\"%s\"", (a > 1)? ", ": "", json_escaped(argv[a]).c_str());
+        fprintf(profile_file, "],\n");
+        fprintf(profile_file, "  \"wall_seconds\": %.6f,\n", wall_time() - start_wall_time);
+        fprintf(profile_file, "  \"cpu_seconds\": %.6f,\n", process_cpu_time() - start_cpu_time);
+        fprintf(profile_file, "  \"peak_rss_mb\": %.1f,\n", peak_memory_in_megabytes());
+
+        fprintf(profile_file, "  \"phases\": {");
+        for(int p = 0; p < (int)phases.size(); p++)
+            fprintf(profile_file, "%s\n    \"%s\": {\"calls\": %lld, \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, \"max_wall_seconds\": %.6f}",
+                    (p > 0)? ",": "", json_escaped(phases[p].name).c_str(), phases[p].calls, phases[p].wall_seconds, phases[p].cpu_seconds, phases[p].max_wall_seconds);
+        fprintf(profile_file, "%s},\n", phases.empty()? "": "\n  ");
+
+        fprintf(profile_file, "  \"counters\": {");
+        for(int c = 0; c < (int)counters.size(); c++)
+            fprintf(profile_file, "%s\n    \"%s\": %.10g", (c > 0)? ",": "", json_escaped(counters[c].name).c_str(), counters[c].value);
+        fprintf(profile_file, "%s},\n", counters.empty()? "": "\n  ");
+
+        fprintf(profile_file, "  \"series\": {");
+        for(int s = 0; s < (int)all_series.size(); s++){
+            fprintf(profile_file, "%s\n    \"%s\": [", (s > 0)? ",": "", json_escaped(all_series[s].name).c_str());
+            for(int i = 0; i < (int)all_series[s].samples.size(); i++)
+                fprintf(profile_file, "%s[%.10g, %.10g]", (i > 0)? ", ": "", all_series[s].samples[i].first, all_series[s].samples[i].second);
+            fprintf(profile_file, "]");
+        }
+        fprintf(profile_file, "%s}\n}\n", all_series.empty()? "": "\n  ");
+
+        if(profile_file != stderr) fclose(profile_file);
+    }
+
+private:
+    shadow_profile(): is_enabled(false), start_wall_time(0), start_cpu_time(0){}
+
+    struct profile_phase{
+        std::string name;
+        long long calls = 0;
+        double wall_seconds = 0, cpu_seconds = 0, max_wall_seconds = 0;
+    };
+    struct profile_counter{
+        std::string name;
+        double value = 0;
+    };
+    struct profile_series{
+        std::string name;
+        std::vector<std::pair<double, double> > samples;
+    };
+
+    bool is_enabled;
+    double start_wall_time, start_cpu_time;
+    std::mutex profile_mutex;
+    std::vector<profile_phase> phases;
+    std::vector<profile_counter> counters;
+    std::vector<profile_series> all_series;
+
+    // There are only a few names, so a linear search keeps them in the order of their first occurrence
+    template<class entry_type>
+    static entry_type& find(std::vector<entry_type>& entries, const char* name){
+        for(auto& entry : entries)
+            if(entry.name == name) return entry;
+        entries.push_back(entry_type());
+        entries.back().name = name;
+        return entries.back();
+    }
+
+    static std::string json_escaped(const std::string& text){
+        std::string escaped;
+        for(char c : text){
+            if(c == '"' || c == '\\'){
+                escaped += '\\';
+                escaped += c;
+            }
+            else if((unsigned char)c < 0x20){
+                char code[8];
+                snprintf(code, sizeof(code), "\\u%04x", (unsigned char)c);
+                escaped += code;
+            }
+            else escaped += c;
+        }
+        return escaped;
+    }
+};
+
+//
+// The following object times one call of the phase [name] from its construction to its destruction.
+// A phase on the main thread is charged the CPU time of the whole process (including the threads it starts),
+// while a phase inside a worker thread (in_worker_thread = true) is charged the CPU time of its own thread;
+// the calls of a phase from several threads add up, so its wall time may exceed the wall time of the run.
+//
+class shadow_profile_phase{
+public:
+    explicit shadow_profile_phase(const char* name, bool in_worker_thread = false): name(name), in_worker_thread(in_worker_thread){
+        is_timed = shadow_profile::instance().enabled();
+        if(!is_timed) return;
+        start_wall_time = shadow_profile::wall_time();
+        start_cpu_time = cpu_time();
+    }
+
+    ~shadow_profile_phase(){
+        if(!is_timed) return;
+        shadow_profile::instance().add_phase(name, shadow_profile::wall_time() - start_wall_time, cpu_time() - start_cpu_time);
+    }
+
+private:
+    const char* name;
+    bool in_worker_thread, is_timed;
+    double start_wall_time, start_cpu_time;
+
+    double cpu_time() const{
+        return in_worker_thread? shadow_profile::thread_cpu_time(): shadow_profile::process_cpu_time();
+    }
+
+    shadow_profile_phase(const shadow_profile_phase&);
+    shadow_profile_phase& operator=(const shadow_profile_phase&);
+};
+
+#endif
@@ -0,0 +1,157 @@
+//
+// This code is created by Hsin-Yuan Huang (https://momohuang.github.io/).
+// For more details, see the accompany paper:
+//  "Predicting Many Properties of a Quantum System from Very Few Measurements".
+//
+// The following generator chooses the Pauli measurements of the randomized classical shadows;
+// data_acquisition_shadow.cpp -r is a command line program around it.
+// The random bits of every shot are a function of the seed and the index of the shot only
+// (a counter-based generator: SplitMix64 started from a hash of the seed and the shot),
+// so the shots can be generated in any order, on any number of threads, with the same result.
+//
+#ifndef SHADOW_RANDOMIZATION_H
+#define SHADOW_RANDOMIZATION_H
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include "shadow_io.h"
+#include "shadow_threads.h"
+
+class shadow_random_scheme{
+public:
+    explicit shadow_random_scheme(unsigned long long seed): seed_key(mix64(seed)){
+        // pauli_groups[b] lists the 5 base-3 digits of the byte b < 243 as the text "P P P P P "
+        for(int b = 0; b < 243; b++){
+            for(int digit = 0, value = b; digit < 5; digit++, value /= 3){
+                pauli_groups[b][2 * digit] = (char)('X' + value % 3);
+                pauli_groups[b][2 * digit + 1] = ' ';
+            }
+        }
+    }
+
+    //
+    // The following function calls group(ith_qubit, byte, count) for the Pauli bases of qubits ith_qubit to ith_qubit+count-1,
+    // which are the first count base-3 digits of byte (X -> 0, Y -> 1, Z -> 2).
+    // Every random byte of the shot is used if it is below 3^5 = 243 and skipped otherwise,
+    // so that the 5 digits are exactly uniform.
+    //
+    template<class group_function>
+    inline void for_each_pauli_group(long long shot, int system_size, group_function group) const{
+        unsigned long long state = mix64(seed_key + (unsigned long long)shot);
+        int ith_qubit = 0;
+        while(ith_qubit < system_size){
+            state += GOLDEN_GAMMA;
+            unsigned long long random_bits = mix64(state);
+            for(int b = 0; b < 8 && ith_qubit < system_size; b++, random_bits >>= 8){
+                int byte = (int)(random_bits & 255);
+                if(byte >= 243) continue;
+                int count = std::min(5, system_size - ith_qubit);
+                group(ith_qubit, byte, count);
+                ith_qubit += count;
+            }
+        }
+    }
+
+    //
+    // The following function writes the line "P P ... P \n" of the shot (2 system_size + 1 characters)
+    // in the format of data_acquisition_shadow.
+    //
+    inline void write_text_shot(long long shot, int system_size, char* line) const{
+        for_each_pauli_group(shot, system_size, [this, line](int ith_qubit, int byte, int count){
+            memcpy(line + 2 * ith_qubit, pauli_groups[byte], 2 * count);
+        });
+        line[2 * system_size] = '\n';
+    }
+
+    //
+    // The following function writes the two planes of the Pauli bases of the shot (2 words_per_plane words, cleared to zero)
+    // in the layout of the .shadow files.
+    //
+    inline void write_packed_shot(long long shot, int system_size, unsigned long long* planes) const{
+        int words_per_plane = (system_size + 63) / 64;
+        for_each_pauli_group(shot, system_size, [planes, words_per_plane](int ith_qubit, int byte, int count){
+            for(int digit = 0; digit < count; digit++, byte /= 3){
+                int pauli_encoding = byte % 3, word = (ith_qubit + digit) >> 6, bit = (ith_qubit + digit) & 63;
+                planes[word] |= (unsigned long long)(pauli_encoding & 1) << bit;
+                planes[words_per_plane + word] |= (unsigned long long)(pauli_encoding >> 1) << bit;
+            }
+        });
+    }
+
+    //
+    // The following function writes the shots from 0 to number_of_shots-1 as text to output_file,
+    // or to the .shadow file binary_file_name (two planes per shot: the bases without outcomes) if it is not NULL.
+    // The shots are generated in chunks of about CHUNK_BYTES on [number_of_threads] threads,
+    // and a chunk is written by another thread while the next chunk is generated.
+    //
+    static const size_t CHUNK_BYTES = 16 << 20;
+
+    void write_shots(long long number_of_shots, int system_size, int number_of_threads, FILE* output_file, const char* binary_file_name) const{
+        bool is_binary = binary_file_name != NULL;
+        int words_per_shot = 2 * ((system_size + 63) / 64);
+        size_t shot_bytes = is_binary? words_per_shot * sizeof(unsigned long long): 2 * (size_t)system_size + 1;
+        long long shots_per_chunk = std::max((long long)1, std::min(number_of_shots, (long long)(CHUNK_BYTES / shot_bytes)));
+
+        shadow_binary_writer binary_writer;
+        if(is_binary) binary_writer.open(binary_file_name, system_size, 2);
+
+        parallel_loop_pool generation_pool;
+        generation_pool.start(number_of_threads);
+        std::vector<unsigned long long> chunks[2];
+        for(auto& chunk : chunks) chunk.resize((shots_per_chunk * shot_bytes + 7) / 8);
+        std::thread writer;
+        std::string write_error; // an exception must not leave the writer thread
+
+        for(long long first_shot = 0, c = 0; first_shot < number_of_shots; first_shot += shots_per_chunk, c++){
+            long long chunk_shots = std::min(shots_per_chunk, number_of_shots - first_shot);
+            std::vector<unsigned long long>& chunk = chunks[c % 2];
+            generation_pool.run((int)chunk_shots, [&](int begin, int end){
+                for(int s = begin; s < end; s++){
+                    if(is_binary){
+                        unsigned long long* planes = chunk.data() + (size_t)s * words_per_shot;
+                        std::fill(planes, planes + words_per_shot, 0ULL);
+                        write_packed_shot(first_shot + s, system_size, planes);
+                    }
+                    else write_text_shot(first_shot + s, system_size, (char*)chunk.data() + (size_t)s * shot_bytes);
+                }
+            });
+
+            if(writer.joinable()) writer.join();
+            if(!write_error.empty()) break;
+            writer = std::thread([&, chunk_shots, c](){
+                try{
+                    if(is_binary) binary_writer.write(chunks[c % 2].data(), chunk_shots);
+                    else if(fwrite(chunks[c % 2].data(), shot_bytes, chunk_shots, output_file) != (size_t)chunk_shots)
+                        throw_shadow_error("failed to write the randomized measurements.");
+                }
+                catch(const shadow_error& error){
+                    write_error = error.what();
+                }
+            });
+        }
+        if(writer.joinable()) writer.join();
+        generation_pool.stop();
+
+        if(!write_error.empty()) throw shadow_error(write_error);
+        if(is_binary) binary_writer.close();
+        else if(fflush(output_file) != 0)
+            throw_shadow_error("failed to write the randomized measurements.");
+    }
+
+private:
+    static const unsigned long long GOLDEN_GAMMA = 0x9e3779b97f4a7c15ULL;
+    unsigned long long seed_key;
+    char pauli_groups[243][10];
+
+    // The output function of SplitMix64
+    static inline unsigned long long mix64(unsigned long long z){
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+};
+
+#endif
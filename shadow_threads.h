@@ -0,0 +1,98 @@
+//
+// This code is created by Hsin-Yuan Huang (https://momohuang.github.io/).
+// For more details, see the accompany paper:
+//  "Predicting Many Properties of a Quantum System from Very Few Measurements".
+//
+// The following pool of threads is shared by the derandomizer of shadow_derandomization.h
+// and the generator of shadow_randomization.h, which split their loops across threads many times per run.
+//
+#ifndef SHADOW_THREADS_H
+#define SHADOW_THREADS_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+//
+// The following class keeps [number_of_threads] - 1 threads waiting for parallel loops,
+// so that a loop can be split across threads many times per second.
+// run(n, loop_body) calls loop_body(begin, end) on contiguous blocks covering 0 to n-1,
+// and returns once all blocks are done.
+//
+class parallel_loop_pool{
+public:
+    void start(int number_of_threads){
+        stopping = false;
+        generation = 0;
+        for(int th = 1; th < number_of_threads; th++)
+            workers.push_back(std::thread(&parallel_loop_pool::worker, this, th));
+    }
+
+    void stop(){
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            stopping = true;
+        }
+        loop_started.notify_all();
+        for(std::thread& worker : workers) worker.join();
+        workers.clear();
+    }
+
+    int size(){
+        return (int)workers.size() + 1;
+    }
+
+    void run(int n, const std::function<void(int, int)>& loop_body){
+        if(workers.empty()){
+            loop_body(0, n);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            current_loop_body = &loop_body;
+            current_n = n;
+            unfinished_workers = (int)workers.size();
+            generation ++;
+        }
+        loop_started.notify_all();
+
+        loop_body(0, block_end(0));
+
+        std::unique_lock<std::mutex> lock(pool_mutex);
+        while(unfinished_workers > 0) loop_finished.wait(lock);
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex pool_mutex;
+    std::condition_variable loop_started, loop_finished;
+    const std::function<void(int, int)>* current_loop_body;
+    int current_n, unfinished_workers;
+    long long generation;
+    bool stopping;
+
+    int block_end(int th){
+        return (int)((long long)current_n * (th + 1) / size());
+    }
+
+    void worker(int th){
+        long long finished_generation = 0;
+        while(true){
+            {
+                std::unique_lock<std::mutex> lock(pool_mutex);
+                while(!stopping && generation == finished_generation) loop_started.wait(lock);
+                if(stopping) return;
+                finished_generation = generation;
+            }
+
+            (*current_loop_body)(block_end(th - 1), block_end(th));
+
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            if(--unfinished_workers == 0) loop_finished.notify_one();
+        }
+    }
+};
+
+#endif